@@ -28,6 +28,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImageLoader.h>
 
 using namespace std;
 
@@ -36,12 +37,15 @@ void LoadImages(const string &strImagePath, const string &strPathTimes,
 
 int main(int argc, char **argv)
 {
-    if(argc != 5)
+    if(argc != 5 && argc != 6)
     {
-        cerr << endl << "Usage: ./mono_tum path_to_vocabulary path_to_settings path_to_image_folder path_to_times_file" << endl;
+        cerr << endl << "Usage: ./mono_tum path_to_vocabulary path_to_settings path_to_image_folder path_to_times_file [offline]" << endl;
         return 1;
     }
 
+    // In offline mode images are processed as fast as possible instead of at camera rate
+    const bool bOffline = argc==6 && string(argv[5])=="offline";
+
     // Retrieve paths to images
     vector<string> vstrImageFilenames;
     vector<double> vTimestamps;
@@ -57,6 +61,12 @@ int main(int argc, char **argv)
 
     // Create SLAM system. It initializes all system threads and gets ready to process frames.
     ORB_SLAM2::System SLAM(argv[1],argv[2],ORB_SLAM2::System::MONOCULAR,true);
+    SLAM.SetOfflineMode(bOffline);
+
+    // Images are read ahead by a pool of threads in offline mode
+    ORB_SLAM2::ImageLoader* pLoader = NULL;
+    if(bOffline)
+        pLoader = new ORB_SLAM2::ImageLoader(vstrImageFilenames,vector<string>(),2,8,CV_LOAD_IMAGE_UNCHANGED);
 
     // Vector for tracking time statistics
     vector<float> vTimesTrack;
@@ -66,12 +76,21 @@ int main(int argc, char **argv)
     cout << "Start processing sequence ..." << endl;
     cout << "Images in the sequence: " << nImages << endl << endl;
 
+#ifdef COMPILEDWITHC11
+    std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+#else
+    std::chrono::monotonic_clock::time_point tStart = std::chrono::monotonic_clock::now();
+#endif
+
     // Main loop
-    cv::Mat im;
+    cv::Mat im, imUnused;
     for(int ni=0; ni<nImages; ni++)
     {
         // Read image from file
-        im = cv::imread(vstrImageFilenames[ni],CV_LOAD_IMAGE_UNCHANGED);
+        if(bOffline)
+            pLoader->GetImages(ni,im,imUnused);
+        else
+            im = cv::imread(vstrImageFilenames[ni],CV_LOAD_IMAGE_UNCHANGED);
         double tframe = vTimestamps[ni];
 
         if(im.empty())
@@ -100,6 +119,9 @@ int main(int argc, char **argv)
 
         vTimesTrack[ni]=ttrack;
 
+        if(bOffline)
+            continue;
+
         // Wait to load the next frame
         double T=0;
         if(ni<nImages-1)
@@ -113,6 +135,15 @@ int main(int argc, char **argv)
 
     // Stop all threads
     SLAM.Shutdown();
+    delete pLoader;
+
+#ifdef COMPILEDWITHC11
+    std::chrono::steady_clock::time_point tEnd = std::chrono::steady_clock::now();
+#else
+    std::chrono::monotonic_clock::time_point tEnd = std::chrono::monotonic_clock::now();
+#endif
+
+    double tTotal = std::chrono::duration_cast<std::chrono::duration<double> >(tEnd - tStart).count();
 
     // Tracking time statistics
     sort(vTimesTrack.begin(),vTimesTrack.end());
@@ -124,6 +155,8 @@ int main(int argc, char **argv)
     cout << "-------" << endl << endl;
     cout << "median tracking time: " << vTimesTrack[nImages/2] << endl;
     cout << "mean tracking time: " << totaltime/nImages << endl;
+    cout << "total processing time: " << tTotal << endl;
+    cout << "throughput (frames/s): " << nImages/tTotal << endl;
 
     // Save camera trajectory
     SLAM.SaveKeyFrameTrajectoryTUM("KeyFrameTrajectory.txt");
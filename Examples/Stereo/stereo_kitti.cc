@@ -29,6 +29,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImageLoader.h>
 
 using namespace std;
 
@@ -37,12 +38,15 @@ void LoadImages(const string &strPathToSequence, vector<string> &vstrImageLeft,
 
 int main(int argc, char **argv)
 {
-    if(argc != 4)
+    if(argc != 4 && argc != 5)
     {
-        cerr << endl << "Usage: ./stereo_kitti path_to_vocabulary path_to_settings path_to_sequence" << endl;
+        cerr << endl << "Usage: ./stereo_kitti path_to_vocabulary path_to_settings path_to_sequence [offline]" << endl;
         return 1;
     }
 
+    // In offline mode images are processed as fast as possible instead of at camera rate
+    const bool bOffline = argc==5 && string(argv[4])=="offline";
+
     // Retrieve paths to images
     vector<string> vstrImageLeft;
     vector<string> vstrImageRight;
@@ -53,6 +57,12 @@ int main(int argc, char **argv)
 
     // Create SLAM system. It initializes all system threads and gets ready to process frames.
     ORB_SLAM2::System SLAM(argv[1],argv[2],ORB_SLAM2::System::STEREO,true);
+    SLAM.SetOfflineMode(bOffline);
+
+    // Images are read ahead by a pool of threads in offline mode
+    ORB_SLAM2::ImageLoader* pLoader = NULL;
+    if(bOffline)
+        pLoader = new ORB_SLAM2::ImageLoader(vstrImageLeft,vstrImageRight,2,8,CV_LOAD_IMAGE_UNCHANGED);
 
     // Vector for tracking time statistics
     vector<float> vTimesTrack;
@@ -62,13 +72,24 @@ int main(int argc, char **argv)
     cout << "Start processing sequence ..." << endl;
     cout << "Images in the sequence: " << nImages << endl << endl;   
 
+#ifdef COMPILEDWITHC11
+    std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+#else
+    std::chrono::monotonic_clock::time_point tStart = std::chrono::monotonic_clock::now();
+#endif
+
     // Main loop
     cv::Mat imLeft, imRight;
     for(int ni=0; ni<nImages; ni++)
     {
         // Read left and right images from file
-        imLeft = cv::imread(vstrImageLeft[ni],CV_LOAD_IMAGE_UNCHANGED);
-        imRight = cv::imread(vstrImageRight[ni],CV_LOAD_IMAGE_UNCHANGED);
+        if(bOffline)
+            pLoader->GetImages(ni,imLeft,imRight);
+        else
+        {
+            imLeft = cv::imread(vstrImageLeft[ni],CV_LOAD_IMAGE_UNCHANGED);
+            imRight = cv::imread(vstrImageRight[ni],CV_LOAD_IMAGE_UNCHANGED);
+        }
         double tframe = vTimestamps[ni];
 
         if(imLeft.empty())
@@ -97,6 +118,9 @@ int main(int argc, char **argv)
 
         vTimesTrack[ni]=ttrack;
 
+        if(bOffline)
+            continue;
+
         // Wait to load the next frame
         double T=0;
         if(ni<nImages-1)
@@ -110,6 +134,15 @@ int main(int argc, char **argv)
 
     // Stop all threads
     SLAM.Shutdown();
+    delete pLoader;
+
+#ifdef COMPILEDWITHC11
+    std::chrono::steady_clock::time_point tEnd = std::chrono::steady_clock::now();
+#else
+    std::chrono::monotonic_clock::time_point tEnd = std::chrono::monotonic_clock::now();
+#endif
+
+    double tTotal = std::chrono::duration_cast<std::chrono::duration<double> >(tEnd - tStart).count();
 
     // Tracking time statistics
     sort(vTimesTrack.begin(),vTimesTrack.end());
@@ -121,6 +154,8 @@ int main(int argc, char **argv)
     cout << "-------" << endl << endl;
     cout << "median tracking time: " << vTimesTrack[nImages/2] << endl;
     cout << "mean tracking time: " << totaltime/nImages << endl;
+    cout << "total processing time: " << tTotal << endl;
+    cout << "throughput (frames/s): " << nImages/tTotal << endl;
 
     // Save camera trajectory
     SLAM.SaveTrajectoryKITTI("CameraTrajectory.txt");
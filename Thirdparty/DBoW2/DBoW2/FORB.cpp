@@ -13,6 +13,8 @@
 #include <vector>
 #include <string>
 #include <sstream>
+#include <cstring>
+#include <algorithm>
 #include <stdint-gcc.h>
 
 #include "FORB.h"
@@ -24,6 +26,7 @@ namespace DBoW2 {
 // --------------------------------------------------------------------------
 
 const int FORB::L=32;
+const int FORB::PACKED_WORDS;
 
 void FORB::meanValue(const std::vector<FORB::pDescriptor> &descriptors, 
   FORB::TDescriptor &mean)
@@ -100,6 +103,19 @@ int FORB::distance(const FORB::TDescriptor &a,
   return dist;
 }
 
+// --------------------------------------------------------------------------
+
+void FORB::pack(const FORB::TDescriptor &a, uint64_t *packed)
+{
+  if(a.empty())
+  {
+    std::fill(packed, packed + FORB::PACKED_WORDS, (uint64_t)0);
+    return;
+  }
+
+  pack(a.ptr<unsigned char>(), packed);
+}
+
 // --------------------------------------------------------------------------
   
 std::string FORB::toString(const FORB::TDescriptor &a)
@@ -13,6 +13,8 @@
 #include <opencv2/core/core.hpp>
 #include <vector>
 #include <string>
+#include <stdint.h>
+#include <cstring>
 
 #include "FClass.h"
 
@@ -29,6 +31,8 @@ public:
   typedef const TDescriptor *pDescriptor;
   /// Descriptor length (in bytes)
   static const int L;
+  /// Descriptor length (in 64-bit words) of a packed descriptor
+  static const int PACKED_WORDS = 4;
 
   /**
    * Calculates the mean value of a set of descriptors
@@ -46,6 +50,68 @@ public:
    */
   static int distance(const TDescriptor &a, const TDescriptor &b);
 
+  /**
+   * Copies a descriptor into PACKED_WORDS 64-bit words. An empty
+   * descriptor is packed as zeros
+   * @param a descriptor
+   * @param packed (out) PACKED_WORDS words
+   */
+  static void pack(const TDescriptor &a, uint64_t *packed);
+
+  /**
+   * Copies a descriptor stored as L contiguous bytes into PACKED_WORDS
+   * 64-bit words
+   * @param a descriptor bytes
+   * @param packed (out) PACKED_WORDS words
+   */
+  static inline void pack(const unsigned char *a, uint64_t *packed)
+  {
+    memcpy(packed, a, PACKED_WORDS * sizeof(uint64_t));
+  }
+
+  /**
+   * Calculates the distance between two packed descriptors. Returns the
+   * same value as distance() on the unpacked descriptors
+   * @param a packed descriptor
+   * @param b packed descriptor
+   * @return distance
+   */
+  static inline int distance(const uint64_t *a, const uint64_t *b)
+  {
+    return __builtin_popcountll(a[0] ^ b[0]) +
+      __builtin_popcountll(a[1] ^ b[1]) +
+      __builtin_popcountll(a[2] ^ b[2]) +
+      __builtin_popcountll(a[3] ^ b[3]);
+  }
+
+  /**
+   * Returns the index of the packed descriptor of a contiguous block
+   * closest to the given one. Ties are resolved in favour of the lowest
+   * index
+   * @param a packed descriptor
+   * @param block n packed descriptors stored one after another
+   * @param n number of descriptors in the block (> 0)
+   * @return index in [0, n)
+   */
+  static inline int closest(const uint64_t *a, const uint64_t *block, int n)
+  {
+    int best = 0;
+    int best_d = distance(a, block);
+
+    for(int i = 1; i < n; ++i)
+    {
+      block += PACKED_WORDS;
+      const int d = distance(a, block);
+      if(d < best_d)
+      {
+        best_d = d;
+        best = i;
+      }
+    }
+
+    return best;
+  }
+
   /**
    * Returns a string version of the descriptor
    * @param a descriptor
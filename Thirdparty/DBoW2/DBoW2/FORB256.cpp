@@ -0,0 +1,177 @@
+/**
+ * File: FORB256.cpp
+ * Description: functions for ORB descriptors stored as 256-bit values
+ * License: see the LICENSE.txt file
+ *
+ */
+
+ 
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+
+#include "FORB256.h"
+
+using namespace std;
+
+namespace DBoW2 {
+
+// --------------------------------------------------------------------------
+
+constexpr int FORB256::PACKED_WORDS;
+constexpr int FORB256::L;
+
+void FORB256::meanValue(const std::vector<FORB256::pDescriptor> &descriptors, 
+  FORB256::TDescriptor &mean)
+{
+  mean.fill(0);
+
+  if(descriptors.empty())
+  {
+    return;
+  }
+  else if(descriptors.size() == 1)
+  {
+    mean = *descriptors[0];
+  }
+  else
+  {
+    vector<int> sum(FORB256::L * 8, 0);
+    
+    for(size_t i = 0; i < descriptors.size(); ++i)
+    {
+      const unsigned char *p = 
+        reinterpret_cast<const unsigned char*>(descriptors[i]->data());
+      
+      for(int j = 0; j < FORB256::L; ++j, ++p)
+      {
+        if(*p & (1 << 7)) ++sum[ j*8     ];
+        if(*p & (1 << 6)) ++sum[ j*8 + 1 ];
+        if(*p & (1 << 5)) ++sum[ j*8 + 2 ];
+        if(*p & (1 << 4)) ++sum[ j*8 + 3 ];
+        if(*p & (1 << 3)) ++sum[ j*8 + 4 ];
+        if(*p & (1 << 2)) ++sum[ j*8 + 5 ];
+        if(*p & (1 << 1)) ++sum[ j*8 + 6 ];
+        if(*p & (1))      ++sum[ j*8 + 7 ];
+      }
+    }
+    
+    unsigned char *p = reinterpret_cast<unsigned char*>(mean.data());
+    
+    const int N2 = (int)descriptors.size() / 2 + descriptors.size() % 2;
+    for(size_t i = 0; i < sum.size(); ++i)
+    {
+      if(sum[i] >= N2)
+      {
+        // set bit
+        *p |= 1 << (7 - (i % 8));
+      }
+      
+      if(i % 8 == 7) ++p;
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+  
+std::string FORB256::toString(const FORB256::TDescriptor &a)
+{
+  stringstream ss;
+  const unsigned char *p = reinterpret_cast<const unsigned char*>(a.data());
+  
+  for(int i = 0; i < FORB256::L; ++i, ++p)
+  {
+    ss << (int)*p << " ";
+  }
+  
+  return ss.str();
+}
+
+// --------------------------------------------------------------------------
+  
+void FORB256::fromString(FORB256::TDescriptor &a, const std::string &s)
+{
+  a.fill(0);
+  unsigned char *p = reinterpret_cast<unsigned char*>(a.data());
+  
+  stringstream ss(s);
+  for(int i = 0; i < FORB256::L; ++i, ++p)
+  {
+    int n;
+    ss >> n;
+    
+    if(!ss.fail()) 
+      *p = (unsigned char)n;
+  }
+  
+}
+
+// --------------------------------------------------------------------------
+
+void FORB256::toMat32F(const std::vector<TDescriptor> &descriptors, 
+  cv::Mat &mat)
+{
+  if(descriptors.empty())
+  {
+    mat.release();
+    return;
+  }
+  
+  const size_t N = descriptors.size();
+  
+  mat.create(N, FORB256::L*8, CV_32F);
+  float *p = mat.ptr<float>();
+  
+  for(size_t i = 0; i < N; ++i)
+  {
+    const unsigned char *desc = 
+      reinterpret_cast<const unsigned char*>(descriptors[i].data());
+    
+    for(int j = 0; j < FORB256::L; ++j, p += 8)
+    {
+      p[0] = (desc[j] & (1 << 7) ? 1 : 0);
+      p[1] = (desc[j] & (1 << 6) ? 1 : 0);
+      p[2] = (desc[j] & (1 << 5) ? 1 : 0);
+      p[3] = (desc[j] & (1 << 4) ? 1 : 0);
+      p[4] = (desc[j] & (1 << 3) ? 1 : 0);
+      p[5] = (desc[j] & (1 << 2) ? 1 : 0);
+      p[6] = (desc[j] & (1 << 1) ? 1 : 0);
+      p[7] = desc[j] & (1);
+    }
+  } 
+}
+
+// --------------------------------------------------------------------------
+
+void FORB256::toMat8U(const std::vector<TDescriptor> &descriptors, 
+  cv::Mat &mat)
+{
+  mat.create(descriptors.size(), FORB256::L, CV_8U);
+  
+  unsigned char *p = mat.ptr<unsigned char>();
+  
+  for(size_t i = 0; i < descriptors.size(); ++i, p += FORB256::L)
+  {
+    const unsigned char *d = 
+      reinterpret_cast<const unsigned char*>(descriptors[i].data());
+    std::copy(d, d+FORB256::L, p);
+  }
+  
+}
+
+// --------------------------------------------------------------------------
+
+void FORB256::fromMat8U(const cv::Mat &mat,
+  std::vector<TDescriptor> &descriptors)
+{
+  descriptors.resize(mat.rows);
+
+  for(int i = 0; i < mat.rows; ++i)
+    pack(mat.ptr<unsigned char>(i), descriptors[i].data());
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW2
+
@@ -0,0 +1,141 @@
+/**
+ * File: FORB256.h
+ * Description: functions for ORB descriptors stored as 256-bit values
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_F_ORB256__
+#define __D_T_F_ORB256__
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <string>
+#include <array>
+#include <stdint.h>
+
+#include "FClass.h"
+#include "FORB.h"
+
+namespace DBoW2 {
+
+/// Functions to manipulate ORB descriptors held in fixed-size arrays.
+/// Same descriptors and distances as FORB, without cv::Mat headers
+class FORB256: protected FClass
+{
+public:
+
+  /// Descriptor length (in 64-bit words)
+  static constexpr int PACKED_WORDS = 4;
+  /// Descriptor length (in bytes)
+  static constexpr int L = PACKED_WORDS * 8;
+
+  /// Descriptor type. Byte i of the descriptor is byte i of the array
+  typedef std::array<uint64_t, PACKED_WORDS> TDescriptor;
+  /// Pointer to a single descriptor
+  typedef const TDescriptor *pDescriptor;
+
+  /**
+   * Calculates the mean value of a set of descriptors
+   * @param descriptors
+   * @param mean mean descriptor
+   */
+  static void meanValue(const std::vector<pDescriptor> &descriptors,
+    TDescriptor &mean);
+
+  /**
+   * Calculates the distance between two descriptors
+   * @param a
+   * @param b
+   * @return distance
+   */
+  static inline int distance(const TDescriptor &a, const TDescriptor &b)
+  {
+    return FORB::distance(a.data(), b.data());
+  }
+
+  /**
+   * Copies a descriptor into PACKED_WORDS 64-bit words
+   * @param a descriptor
+   * @param packed (out) PACKED_WORDS words
+   */
+  static inline void pack(const TDescriptor &a, uint64_t *packed)
+  {
+    std::copy(a.begin(), a.end(), packed);
+  }
+
+  /**
+   * Copies a descriptor stored as L contiguous bytes into PACKED_WORDS
+   * 64-bit words
+   * @param a descriptor bytes
+   * @param packed (out) PACKED_WORDS words
+   */
+  static inline void pack(const unsigned char *a, uint64_t *packed)
+  {
+    FORB::pack(a, packed);
+  }
+
+  /**
+   * Calculates the distance between two packed descriptors
+   * @param a packed descriptor
+   * @param b packed descriptor
+   * @return distance
+   */
+  static inline int distance(const uint64_t *a, const uint64_t *b)
+  {
+    return FORB::distance(a, b);
+  }
+
+  /**
+   * Returns the index of the packed descriptor of a contiguous block
+   * closest to the given one. Ties are resolved in favour of the lowest
+   * index
+   * @param a packed descriptor
+   * @param block n packed descriptors stored one after another
+   * @param n number of descriptors in the block (> 0)
+   * @return index in [0, n)
+   */
+  static inline int closest(const uint64_t *a, const uint64_t *block, int n)
+  {
+    return FORB::closest(a, block, n);
+  }
+
+  /**
+   * Returns a string version of the descriptor
+   * @param a descriptor
+   * @return string version
+   */
+  static std::string toString(const TDescriptor &a);
+
+  /**
+   * Returns a descriptor from a string
+   * @param a descriptor
+   * @param s string version
+   */
+  static void fromString(TDescriptor &a, const std::string &s);
+
+  /**
+   * Returns a mat with the descriptors in float format
+   * @param descriptors
+   * @param mat (out) NxL 32F matrix
+   */
+  static void toMat32F(const std::vector<TDescriptor> &descriptors,
+    cv::Mat &mat);
+
+  static void toMat8U(const std::vector<TDescriptor> &descriptors,
+    cv::Mat &mat);
+
+  /**
+   * Returns the descriptors stored in the rows of a mat
+   * @param mat NxL 8U matrix
+   * @param descriptors (out)
+   */
+  static void fromMat8U(const cv::Mat &mat,
+    std::vector<TDescriptor> &descriptors);
+
+};
+
+} // namespace DBoW2
+
+#endif
+
@@ -26,6 +26,8 @@
 #include <algorithm>
 #include <opencv2/core/core.hpp>
 #include <limits>
+#include <stdint.h>
+#include <thread>
 
 #include "FeatureVector.h"
 #include "BowVector.h"
@@ -145,6 +147,19 @@ public:
   virtual void transform(const std::vector<TDescriptor>& features,
     BowVector &v, FeatureVector &fv, int levelsup) const;
 
+  /**
+   * Transforms the rows of a descriptor matrix into a bow vector and a
+   * feature vector. The rows are read in place and split among up to
+   * getTransformThreads() threads. The result is the same as transforming
+   * the vector of rows
+   * @param features descriptors, one per row
+   * @param v (out) bow vector
+   * @param fv (out) feature vector of nodes and feature indexes
+   * @param levelsup levels to go up the vocabulary tree to get the node index
+   */
+  void transformRows(const cv::Mat &features,
+    BowVector &v, FeatureVector &fv, int levelsup) const;
+
   /**
    * Transforms a single feature into a word (without weight)
    * @param feature
@@ -234,6 +249,19 @@ public:
    */
   void setScoringType(ScoringType type);
 
+  /**
+   * Returns the maximum number of threads used by transformRows
+   * @return number of threads
+   */
+  inline int getTransformThreads() const { return m_transform_threads; }
+
+  /**
+   * Changes the maximum number of threads used by transformRows
+   * @param n number of threads (>= 1)
+   */
+  inline void setTransformThreads(int n)
+    { m_transform_threads = (n > 1 ? n : 1); }
+
   /**
    * Loads the vocabulary from a text file
    * @param filename
@@ -313,13 +341,14 @@ protected:
     /**
      * Empty constructor
      */
-    Node(): id(0), weight(0), parent(0), word_id(0){}
+    Node(): id(0), weight(0), parent(0), descriptor(), word_id(0){}
     
     /**
      * Constructor
      * @param _id node id
      */
-    Node(NodeId _id): id(_id), weight(0), parent(0), word_id(0){}
+    Node(NodeId _id): id(_id), weight(0), parent(0), descriptor(),
+      word_id(0){}
 
     /**
      * Returns whether the node is a leaf node
@@ -361,6 +390,31 @@ protected:
    * @param id (out) word id
    */
   virtual void transform(const TDescriptor &feature, WordId &id) const;
+
+  /**
+   * Returns the word id associated to a packed feature
+   * @param feature F::PACKED_WORDS words
+   * @param id (out) word id
+   * @param weight (out) word weight
+   * @param nid (out) if given, id of the node "levelsup" levels up
+   * @param levelsup
+   */
+  void transformPacked(const uint64_t *feature,
+    WordId &id, WordValue &weight, NodeId* nid, int levelsup) const;
+
+  /**
+   * Returns the words associated to the rows [i0, i1) of a descriptor
+   * matrix. Used by transformRows
+   * @param features descriptors, one per row
+   * @param i0 first row
+   * @param i1 last row (exclusive)
+   * @param levelsup
+   * @param ids (out) word id of each row
+   * @param weights (out) word weight of each row
+   * @param nids (out) id of the node "levelsup" levels up of each row
+   */
+  void transformRowRange(const cv::Mat &features, int i0, int i1,
+    int levelsup, WordId *ids, WordValue *weights, NodeId *nids) const;
       
   /**
    * Creates a level in the tree, under the parent, by running kmeans with
@@ -393,6 +447,12 @@ protected:
    * Create the words of the vocabulary once the tree has been built
    */
   void createWords();
+
+  /**
+   * Creates the flattened copy of the tree used by transform once the
+   * nodes and the words have been created or loaded
+   */
+  void createFlatTree();
   
   /**
    * Sets the weights of the nodes of tree according to the given features.
@@ -418,6 +478,9 @@ protected:
   
   /// Object for computing scores
   GeneralScoring* m_scoring_object;
+
+  /// Maximum number of threads used by transformRows
+  int m_transform_threads;
   
   /// Tree nodes
   std::vector<Node> m_nodes;
@@ -425,6 +488,23 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Node of the flattened tree
+  struct FlatNode
+  {
+    /// Flat index of the first child (children are contiguous)
+    unsigned int first_child;
+    /// Number of children (0 for leaves)
+    unsigned int n_children;
+    /// Id of the node in m_nodes
+    NodeId id;
+  };
+
+  /// Tree nodes in breadth-first order, root first
+  std::vector<FlatNode> m_flat_nodes;
+
+  /// Packed descriptors of m_flat_nodes, F::PACKED_WORDS words per node
+  std::vector<uint64_t> m_flat_descriptors;
   
 };
 
@@ -434,7 +514,7 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
   (int k, int L, WeightingType weighting, ScoringType scoring)
   : m_k(k), m_L(L), m_weighting(weighting), m_scoring(scoring),
-  m_scoring_object(NULL)
+  m_scoring_object(NULL), m_transform_threads(1)
 {
   createScoringObject();
 }
@@ -443,7 +523,8 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const std::string &filename): m_scoring_object(NULL)
+  (const std::string &filename): m_scoring_object(NULL),
+  m_transform_threads(1)
 {
   load(filename);
 }
@@ -452,7 +533,8 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const char *filename): m_scoring_object(NULL)
+  (const char *filename): m_scoring_object(NULL),
+  m_transform_threads(1)
 {
   load(filename);
 }
@@ -516,7 +598,7 @@ void TemplatedVocabulary<TDescriptor,F>::setWeightingType(WeightingType type)
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary(
   const TemplatedVocabulary<TDescriptor, F> &voc)
-  : m_scoring_object(NULL)
+  : m_scoring_object(NULL), m_transform_threads(1)
 {
   *this = voc;
 }
@@ -540,6 +622,7 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   this->m_L = voc.m_L;
   this->m_scoring = voc.m_scoring;
   this->m_weighting = voc.m_weighting;
+  this->m_transform_threads = voc.m_transform_threads;
 
   this->createScoringObject();
   
@@ -548,6 +631,7 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   
   this->m_nodes = voc.m_nodes;
   this->createWords();
+  this->createFlatTree();
   
   return *this;
 }
@@ -583,6 +667,8 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 
   // and set the weight of each node of the tree
   setNodeWeights(training_features);
+
+  createFlatTree();
   
 }
 
@@ -939,6 +1025,43 @@ void TemplatedVocabulary<TDescriptor,F>::createWords()
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::createFlatTree()
+{
+  m_flat_nodes.clear();
+  m_flat_descriptors.clear();
+
+  if(m_nodes.empty()) return;
+
+  m_flat_nodes.resize(m_nodes.size());
+  m_flat_descriptors.resize(m_nodes.size() * F::PACKED_WORDS);
+
+  // breadth-first traversal: the flat nodes are written in the order they
+  // are visited, and the children of a node are enqueued together
+  m_flat_nodes[0].id = 0;
+  unsigned int n_flat = 1;
+
+  for(unsigned int i = 0; i < n_flat; ++i)
+  {
+    FlatNode &fnode = m_flat_nodes[i];
+    const Node &node = m_nodes[fnode.id];
+
+    F::pack(node.descriptor, &m_flat_descriptors[i * F::PACKED_WORDS]);
+
+    fnode.first_child = n_flat;
+    fnode.n_children = node.children.size();
+
+    for(size_t c = 0; c < node.children.size(); ++c, ++n_flat)
+      m_flat_nodes[n_flat].id = node.children[c];
+  }
+
+  // nodes not reachable from the root are never visited by transform
+  m_flat_nodes.resize(n_flat);
+  m_flat_descriptors.resize(n_flat * F::PACKED_WORDS);
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::setNodeWeights
   (const vector<vector<TDescriptor> > &training_features)
@@ -1195,6 +1318,103 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F> 
+void TemplatedVocabulary<TDescriptor,F>::transformRows(
+  const cv::Mat &features,
+  BowVector &v, FeatureVector &fv, int levelsup) const
+{
+  v.clear();
+  fv.clear();
+  
+  if(empty() || features.rows == 0) // safe for subclasses
+  {
+    return;
+  }
+
+  // each thread gets a contiguous range of rows. Small sets are not worth
+  // starting threads for
+  const int min_rows_per_thread = 128;
+  const int N = features.rows;
+  int nthreads = std::min(m_transform_threads, N / min_rows_per_thread);
+  if(nthreads < 1) nthreads = 1;
+  const int chunk = (N + nthreads - 1) / nthreads;
+
+  std::vector<WordId> ids(N);
+  std::vector<WordValue> weights(N);
+  std::vector<NodeId> nids(N);
+
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads - 1);
+  for(int t = 1; t < nthreads; ++t)
+  {
+    threads.push_back(std::thread(
+      &TemplatedVocabulary<TDescriptor,F>::transformRowRange, this,
+      std::cref(features), t * chunk, std::min(N, (t + 1) * chunk), levelsup,
+      &ids[0], &weights[0], &nids[0]));
+  }
+  transformRowRange(features, 0, std::min(N, chunk), levelsup,
+    &ids[0], &weights[0], &nids[0]);
+
+  for(size_t t = 0; t < threads.size(); ++t)
+    threads[t].join();
+
+  // the words are added in row order, as in the serial transform, so that
+  // the result does not depend on the number of threads
+  LNorm norm;
+  bool must = m_scoring_object->mustNormalize(norm);
+
+  if(m_weighting == TF || m_weighting == TF_IDF)
+  {
+    for(int i = 0; i < N; ++i)
+    {
+      if(weights[i] > 0) // not stopped
+      { 
+        v.addWeight(ids[i], weights[i]);
+        fv.addFeature(nids[i], i);
+      }
+    }
+    
+    if(!v.empty() && !must)
+    {
+      // unnecessary when normalizing
+      const double nd = v.size();
+      for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++) 
+        vit->second /= nd;
+    }
+  }
+  else // IDF || BINARY
+  {
+    for(int i = 0; i < N; ++i)
+    {
+      if(weights[i] > 0) // not stopped
+      {
+        v.addIfNotExist(ids[i], weights[i]);
+        fv.addFeature(nids[i], i);
+      }
+    }
+  } // if m_weighting == ...
+  
+  if(must) v.normalize(norm);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F> 
+void TemplatedVocabulary<TDescriptor,F>::transformRowRange(
+  const cv::Mat &features, int i0, int i1, int levelsup,
+  WordId *ids, WordValue *weights, NodeId *nids) const
+{
+  uint64_t packed[F::PACKED_WORDS];
+
+  for(int i = i0; i < i1; ++i)
+  {
+    F::pack(features.ptr<unsigned char>(i), packed);
+    transformPacked(packed, ids[i], weights[i], &nids[i], levelsup);
+  }
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F> 
 inline double TemplatedVocabulary<TDescriptor,F>::score
   (const BowVector &v1, const BowVector &v2) const
@@ -1218,44 +1438,47 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
 { 
-  // propagate the feature down the tree
-  vector<NodeId> nodes;
-  typename vector<NodeId>::const_iterator nit;
+  uint64_t packed[F::PACKED_WORDS];
+  F::pack(feature, packed);
+  transformPacked(packed, word_id, weight, nid, levelsup);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transformPacked(const uint64_t *feature,
+  WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
+{
+  // propagate the feature down the flattened tree. The children of each
+  // node are contiguous, so choosing a branch reads a single block of
+  // packed descriptors
 
   // level at which the node must be stored in nid, if given
   const int nid_level = m_L - levelsup;
   if(nid_level <= 0 && nid != NULL) *nid = 0; // root
 
-  NodeId final_id = 0; // root
+  unsigned int flat_id = 0; // root
   int current_level = 0;
 
   do
   {
     ++current_level;
-    nodes = m_nodes[final_id].children;
-    final_id = nodes[0];
- 
-    double best_d = F::distance(feature, m_nodes[final_id].descriptor);
+    const FlatNode &fnode = m_flat_nodes[flat_id];
 
-    for(nit = nodes.begin() + 1; nit != nodes.end(); ++nit)
-    {
-      NodeId id = *nit;
-      double d = F::distance(feature, m_nodes[id].descriptor);
-      if(d < best_d)
-      {
-        best_d = d;
-        final_id = id;
-      }
-    }
+    // ties go to the first child, as in the node-by-node search
+    flat_id = fnode.first_child + F::closest(feature,
+      &m_flat_descriptors[fnode.first_child * F::PACKED_WORDS],
+      fnode.n_children);
     
     if(nid != NULL && current_level == nid_level)
-      *nid = final_id;
+      *nid = m_flat_nodes[flat_id].id;
     
-  } while( !m_nodes[final_id].isLeaf() );
+  } while( m_flat_nodes[flat_id].n_children > 0 );
 
   // turn node id into word id
-  word_id = m_nodes[final_id].word_id;
-  weight = m_nodes[final_id].weight;
+  const Node &final_node = m_nodes[m_flat_nodes[flat_id].id];
+  word_id = final_node.word_id;
+  weight = final_node.weight;
 }
 
 // --------------------------------------------------------------------------
@@ -1345,6 +1568,7 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
 
     m_words.clear();
     m_nodes.clear();
+    createFlatTree();
 
     string s;
     getline(f,s);
@@ -1419,6 +1643,8 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
         }
     }
 
+    createFlatTree();
+
     return true;
 
 }
@@ -1619,6 +1845,8 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  createFlatTree();
 }
 
 // --------------------------------------------------------------------------
@@ -0,0 +1,123 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Feature extraction, stereo matching and vocabulary kernels
+
+#include <benchmark/benchmark.h>
+
+#include "bench_fixture.h"
+#include "ORBmatcher.h"
+
+using namespace std;
+using namespace ORB_SLAM2;
+
+static void BM_ORBextractor(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    vector<cv::KeyPoint> vKeys;
+    cv::Mat descriptors;
+    for(auto _ : state)
+    {
+        (*fixture.mpORBextractorLeft)(fixture.mvImLeft[0],cv::Mat(),vKeys,descriptors);
+    }
+    state.counters["keypoints"] = vKeys.size();
+}
+BENCHMARK(BM_ORBextractor)->Unit(benchmark::kMillisecond);
+
+static void BM_DescriptorDistance(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    const cv::Mat &D1 = fixture.mvFrames[0].mDescriptors;
+    const cv::Mat &D2 = fixture.mvFrames[1].mDescriptors;
+    const int n = min(D1.rows,D2.rows);
+    for(auto _ : state)
+    {
+        int sum = 0;
+        for(int i=0; i<n; i++)
+            sum += ORBmatcher::DescriptorDistance(D1.row(i),D2.row(i));
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations()*n);
+}
+BENCHMARK(BM_DescriptorDistance);
+
+static void BM_GetFeaturesInArea(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    const Frame &F = fixture.mvFrames[1];
+    const float r = state.range(0);
+    for(auto _ : state)
+    {
+        size_t nFound = 0;
+        for(int i=0; i<F.N; i++)
+        {
+            const cv::KeyPoint &kp = F.mvKeysUn[i];
+            nFound += F.GetFeaturesInArea(kp.pt.x,kp.pt.y,r).size();
+        }
+        benchmark::DoNotOptimize(nFound);
+    }
+    state.SetItemsProcessed(state.iterations()*F.N);
+}
+BENCHMARK(BM_GetFeaturesInArea)->Arg(5)->Arg(15)->Arg(50);
+
+static void BM_ComputeStereoMatches(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    // The frame must be built right before, it uses the image pyramids stored in the extractors
+    Frame F = fixture.MakeFrame(0);
+    for(auto _ : state)
+    {
+        F.ComputeStereoMatches();
+    }
+    state.counters["keypoints"] = F.N;
+}
+BENCHMARK(BM_ComputeStereoMatches)->Unit(benchmark::kMillisecond);
+
+static void BM_VocabularyTransform(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    vector<DBoW2::FORB256::TDescriptor> vDesc;
+    DBoW2::FORB256::fromMat8U(fixture.mvFrames[0].mDescriptors,vDesc);
+    DBoW2::BowVector bowVec;
+    DBoW2::FeatureVector featVec;
+    for(auto _ : state)
+    {
+        fixture.mpVocabulary->transform(vDesc,bowVec,featVec,4);
+    }
+    state.SetItemsProcessed(state.iterations()*vDesc.size());
+}
+BENCHMARK(BM_VocabularyTransform)->Unit(benchmark::kMicrosecond);
+
+static void BM_VocabularyTransformRows(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    const cv::Mat &desc = fixture.mvFrames[0].mDescriptors;
+    DBoW2::BowVector bowVec;
+    DBoW2::FeatureVector featVec;
+    const int nThreads = fixture.mpVocabulary->getTransformThreads();
+    fixture.mpVocabulary->setTransformThreads(state.range(0));
+    for(auto _ : state)
+    {
+        fixture.mpVocabulary->transformRows(desc,bowVec,featVec,4);
+    }
+    fixture.mpVocabulary->setTransformThreads(nThreads);
+    state.SetItemsProcessed(state.iterations()*desc.rows);
+}
+BENCHMARK(BM_VocabularyTransformRows)->Arg(1)->Arg(2)->Arg(4)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,266 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bench_fixture.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
+#include <map>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "MapPoint.h"
+#include "ORBmatcher.h"
+#include "Optimizer.h"
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+string BenchFixture::msVocFile;
+string BenchFixture::msSettingsFile;
+string BenchFixture::msSequence;
+int BenchFixture::mnMaxFrames = 20;
+
+void BenchFixture::SetPaths(const string &strVocFile, const string &strSettingsFile,
+                            const string &strSequence, const int nMaxFrames)
+{
+    msVocFile = strVocFile;
+    msSettingsFile = strSettingsFile;
+    msSequence = strSequence;
+    mnMaxFrames = nMaxFrames;
+}
+
+BenchFixture& BenchFixture::Get()
+{
+    static BenchFixture fixture;
+    return fixture;
+}
+
+BenchFixture::BenchFixture()
+{
+    cout << "Loading ORB Vocabulary..." << endl;
+    mpVocabulary = new ORBVocabulary();
+    if(!mpVocabulary->loadFromTextFile(msVocFile))
+    {
+        cerr << "Falied to open vocabulary at: " << msVocFile << endl;
+        exit(-1);
+    }
+
+    LoadSettings();
+    LoadImages();
+    BuildMap();
+}
+
+void BenchFixture::LoadSettings()
+{
+    cv::FileStorage fSettings(msSettingsFile, cv::FileStorage::READ);
+    if(!fSettings.isOpened())
+    {
+        cerr << "Failed to open settings file at: " << msSettingsFile << endl;
+        exit(-1);
+    }
+
+    float fx = fSettings["Camera.fx"];
+    float fy = fSettings["Camera.fy"];
+    float cx = fSettings["Camera.cx"];
+    float cy = fSettings["Camera.cy"];
+
+    mK = cv::Mat::eye(3,3,CV_32F);
+    mK.at<float>(0,0) = fx;
+    mK.at<float>(1,1) = fy;
+    mK.at<float>(0,2) = cx;
+    mK.at<float>(1,2) = cy;
+
+    mDistCoef = cv::Mat(4,1,CV_32F);
+    mDistCoef.at<float>(0) = fSettings["Camera.k1"];
+    mDistCoef.at<float>(1) = fSettings["Camera.k2"];
+    mDistCoef.at<float>(2) = fSettings["Camera.p1"];
+    mDistCoef.at<float>(3) = fSettings["Camera.p2"];
+
+    mbf = fSettings["Camera.bf"];
+    mThDepth = mbf*(float)fSettings["ThDepth"]/fx;
+
+    int nFeatures = fSettings["ORBextractor.nFeatures"];
+    float fScaleFactor = fSettings["ORBextractor.scaleFactor"];
+    int nLevels = fSettings["ORBextractor.nLevels"];
+    int fIniThFAST = fSettings["ORBextractor.iniThFAST"];
+    int fMinThFAST = fSettings["ORBextractor.minThFAST"];
+
+    mpORBextractorLeft = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+    mpORBextractorRight = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+}
+
+void BenchFixture::LoadImages()
+{
+    for(int i=0; i<mnMaxFrames; i++)
+    {
+        stringstream ss;
+        ss << setfill('0') << setw(6) << i;
+        cv::Mat imLeft = cv::imread(msSequence + "/image_0/" + ss.str() + ".png",CV_LOAD_IMAGE_GRAYSCALE);
+        cv::Mat imRight = cv::imread(msSequence + "/image_1/" + ss.str() + ".png",CV_LOAD_IMAGE_GRAYSCALE);
+        if(imLeft.empty() || imRight.empty())
+            break;
+
+        mvImLeft.push_back(imLeft);
+        mvImRight.push_back(imRight);
+    }
+
+    if(mvImLeft.size()<2)
+    {
+        cerr << "At least two stereo pairs are needed in: " << msSequence << endl;
+        exit(-1);
+    }
+
+    cout << "Loaded " << mvImLeft.size() << " stereo pairs" << endl;
+}
+
+Frame BenchFixture::MakeFrame(const size_t i)
+{
+    return Frame(mvImLeft[i],mvImRight[i],static_cast<double>(i),mpORBextractorLeft,mpORBextractorRight,
+                 mpVocabulary,mK,mDistCoef,mbf,mThDepth);
+}
+
+Map* BenchFixture::CopyMap(KeyFrameDatabase* pKFDB, vector<KeyFrame*> &vpKeyFrames)
+{
+    Map* pMap = new Map();
+    vpKeyFrames.clear();
+
+    // The tracked frames keep the associations to the points of the fixture map
+    std::map<MapPoint*,MapPoint*> mCopies;
+    for(size_t i=0; i<mvFrames.size(); i++)
+    {
+        KeyFrame* pKF = new KeyFrame(mvFrames[i],pMap,pKFDB);
+        pMap->AddKeyFrame(pKF);
+
+        for(int j=0; j<mvFrames[i].N; j++)
+        {
+            MapPoint* pMP = mvFrames[i].mvpMapPoints[j];
+            if(!pMP)
+                continue;
+
+            MapPoint* &pCopy = mCopies[pMP];
+            if(!pCopy)
+            {
+                pCopy = new MapPoint(pMP->GetWorldPos(),pKF,pMap);
+                pMap->AddMapPoint(pCopy);
+            }
+            pCopy->AddObservation(pKF,j);
+            pKF->AddMapPoint(pCopy,j);
+        }
+
+        vpKeyFrames.push_back(pKF);
+    }
+
+    for(std::map<MapPoint*,MapPoint*>::iterator mit=mCopies.begin(), mend=mCopies.end(); mit!=mend; mit++)
+    {
+        mit->second->ComputeDistinctiveDescriptors();
+        mit->second->UpdateNormalAndDepth();
+    }
+
+    for(size_t i=0; i<vpKeyFrames.size(); i++)
+        vpKeyFrames[i]->UpdateConnections();
+
+    pMap->mvpKeyFrameOrigins.push_back(vpKeyFrames[0]);
+
+    return pMap;
+}
+
+void BenchFixture::BuildMap()
+{
+    mpMap = new Map();
+    mpKeyFrameDB = new KeyFrameDatabase(*mpVocabulary);
+
+    ORBmatcher matcher(0.9,true);
+
+    for(size_t i=0; i<mvImLeft.size(); i++)
+    {
+        Frame F = MakeFrame(i);
+
+        if(i==0)
+        {
+            F.SetPose(cv::Mat::eye(4,4,CV_32F));
+        }
+        else
+        {
+            // Constant position model, then the same search and optimization as Tracking
+            const Frame &LastFrame = mvFrames.back();
+            F.SetPose(LastFrame.mTcw);
+            fill(F.mvpMapPoints.begin(),F.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+            matcher.SearchByProjection(F,LastFrame,15,false);
+            Optimizer::PoseOptimization(&F);
+
+            for(int j=0; j<F.N; j++)
+            {
+                if(F.mvpMapPoints[j] && F.mvbOutlier[j])
+                {
+                    F.mvpMapPoints[j] = static_cast<MapPoint*>(NULL);
+                    F.mvbOutlier[j] = false;
+                }
+            }
+        }
+
+        // Every frame is a keyframe: observations of tracked points and new points from stereo
+        F.ComputeBoW();
+        KeyFrame* pKF = new KeyFrame(F,mpMap,mpKeyFrameDB);
+        mpMap->AddKeyFrame(pKF);
+
+        for(int j=0; j<F.N; j++)
+        {
+            MapPoint* pMP = F.mvpMapPoints[j];
+            if(pMP)
+            {
+                pMP->AddObservation(pKF,j);
+            }
+            else if(F.mvDepth[j]>0)
+            {
+                cv::Mat x3D = F.UnprojectStereo(j);
+                pMP = new MapPoint(x3D,pKF,mpMap);
+                pMP->AddObservation(pKF,j);
+                pKF->AddMapPoint(pMP,j);
+                mpMap->AddMapPoint(pMP);
+                F.mvpMapPoints[j] = pMP;
+            }
+            else
+                continue;
+
+            pMP->ComputeDistinctiveDescriptors();
+            pMP->UpdateNormalAndDepth();
+        }
+
+        pKF->UpdateConnections();
+        mpKeyFrameDB->add(pKF);
+
+        if(i==0)
+            mpMap->mvpKeyFrameOrigins.push_back(pKF);
+
+        F.mpReferenceKF = pKF;
+        mvFrames.push_back(F);
+        mvpKeyFrames.push_back(pKF);
+    }
+
+    cout << "Fixture map: " << mpMap->KeyFramesInMap() << " keyframes, "
+         << mpMap->MapPointsInMap() << " points" << endl;
+}
+
+} //namespace ORB_SLAM
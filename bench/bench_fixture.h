@@ -0,0 +1,97 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCH_FIXTURE_H
+#define BENCH_FIXTURE_H
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "ORBVocabulary.h"
+#include "ORBextractor.h"
+#include "Frame.h"
+#include "KeyFrame.h"
+#include "Map.h"
+#include "KeyFrameDatabase.h"
+
+namespace ORB_SLAM2
+{
+
+// Data shared by all the benchmarks. It is built once from a recorded stereo sequence
+// (KITTI layout: image_0/, image_1/, times.txt) and a settings file like Examples/Stereo/KITTI*.yaml.
+// Each frame is tracked against the previous one and inserted as a keyframe, with new MapPoints
+// from stereo, so that the map has a realistic covisibility graph.
+class BenchFixture
+{
+public:
+
+    // Must be called before Get()
+    static void SetPaths(const std::string &strVocFile, const std::string &strSettingsFile,
+                         const std::string &strSequence, const int nMaxFrames);
+
+    static BenchFixture& Get();
+
+    ORBVocabulary* mpVocabulary;
+    ORBextractor* mpORBextractorLeft;
+    ORBextractor* mpORBextractorRight;
+
+    cv::Mat mK;
+    cv::Mat mDistCoef;
+    float mbf;
+    float mThDepth;
+
+    // Grayscale images
+    std::vector<cv::Mat> mvImLeft;
+    std::vector<cv::Mat> mvImRight;
+
+    // Tracked frames, with their pose and MapPoint associations
+    std::vector<Frame> mvFrames;
+
+    Map* mpMap;
+    KeyFrameDatabase* mpKeyFrameDB;
+    std::vector<KeyFrame*> mvpKeyFrames;
+
+    // Builds a new frame from the images of frame i (resets the extractor image pyramids)
+    Frame MakeFrame(const size_t i);
+
+    // Builds a copy of the map (keyframes, points and covisibility graph) for benchmarks that
+    // modify it. Its keyframes are returned in the same order as mvpKeyFrames. Free it with
+    // Map::clear() and delete.
+    Map* CopyMap(KeyFrameDatabase* pKFDB, std::vector<KeyFrame*> &vpKeyFrames);
+
+protected:
+
+    BenchFixture();
+
+    void LoadSettings();
+    void LoadImages();
+    void BuildMap();
+
+    static std::string msVocFile;
+    static std::string msSettingsFile;
+    static std::string msSequence;
+    static int mnMaxFrames;
+};
+
+} //namespace ORB_SLAM
+
+#endif // BENCH_FIXTURE_H
@@ -0,0 +1,128 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Pose estimation and optimization
+
+#include <benchmark/benchmark.h>
+
+#include "bench_fixture.h"
+#include "ORBmatcher.h"
+#include "Optimizer.h"
+#include "PnPsolver.h"
+#include "Sim3Solver.h"
+
+#include "Thirdparty/DBoW2/DUtils/Random.h"
+
+using namespace std;
+using namespace ORB_SLAM2;
+
+static void BM_PoseOptimization(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    const size_t n = fixture.mvFrames.size();
+    Frame F(fixture.mvFrames[n-1]);
+    // Start from the previous pose as Tracking does
+    const cv::Mat Tini = fixture.mvFrames[n-2].mTcw.clone();
+    int nInliers = 0;
+    for(auto _ : state)
+    {
+        F.SetPose(Tini);
+        nInliers = Optimizer::PoseOptimization(&F);
+    }
+    state.counters["inliers"] = nInliers;
+}
+BENCHMARK(BM_PoseOptimization)->Unit(benchmark::kMicrosecond);
+
+static void BM_LocalBundleAdjustment(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    // The map is refined in place, each iteration optimizes a fresh copy of the fixture map
+    for(auto _ : state)
+    {
+        state.PauseTiming();
+        KeyFrameDatabase KFDB(*fixture.mpVocabulary);
+        vector<KeyFrame*> vpKFs;
+        Map* pMap = fixture.CopyMap(&KFDB,vpKFs);
+        state.ResumeTiming();
+
+        bool bStop = false;
+        Optimizer::LocalBundleAdjustment(vpKFs.back(),&bStop,pMap);
+
+        state.PauseTiming();
+        pMap->clear();
+        delete pMap;
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_LocalBundleAdjustment)->Unit(benchmark::kMillisecond);
+
+static void BM_PnPsolver(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    const size_t n = fixture.mvpKeyFrames.size();
+    KeyFrame* pKF = fixture.mvpKeyFrames[n-2];
+    Frame F(fixture.mvFrames[n-1]);
+
+    // Same setup as in relocalization
+    vector<MapPoint*> vpMapPointMatches;
+    ORBmatcher matcher(0.75,true);
+    const int nMatches = matcher.SearchByBoW(pKF,F,vpMapPointMatches);
+
+    vector<bool> vbInliers;
+    int nInliers = 0;
+    for(auto _ : state)
+    {
+        DUtils::Random::SeedRand(0);
+        PnPsolver solver(F,vpMapPointMatches);
+        solver.SetRansacParameters(0.99,10,300,4,0.5,5.991);
+        cv::Mat Tcw = solver.find(vbInliers,nInliers);
+        benchmark::DoNotOptimize(Tcw);
+    }
+    state.counters["matches"] = nMatches;
+    state.counters["inliers"] = nInliers;
+}
+BENCHMARK(BM_PnPsolver)->Unit(benchmark::kMicrosecond);
+
+static void BM_Sim3Solver(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    const size_t n = fixture.mvpKeyFrames.size();
+    KeyFrame* pKF1 = fixture.mvpKeyFrames[n-1];
+    KeyFrame* pKF2 = fixture.mvpKeyFrames[n-2];
+
+    // Same setup as in loop detection
+    vector<MapPoint*> vpMatches12;
+    ORBmatcher matcher(0.75,true);
+    const int nMatches = matcher.SearchByBoW(pKF1,pKF2,vpMatches12);
+
+    vector<bool> vbInliers;
+    int nInliers = 0;
+    for(auto _ : state)
+    {
+        DUtils::Random::SeedRand(0);
+        Sim3Solver solver(pKF1,pKF2,vpMatches12,true);
+        solver.SetRansacParameters(0.99,20,300);
+        cv::Mat Scm = solver.find(vbInliers,nInliers);
+        benchmark::DoNotOptimize(Scm);
+    }
+    state.counters["matches"] = nMatches;
+    state.counters["inliers"] = nInliers;
+}
+BENCHMARK(BM_Sim3Solver)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,47 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <cstdlib>
+
+#include <benchmark/benchmark.h>
+
+#include "bench_fixture.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    // Removes the --benchmark_* options (filter, repetitions, JSON output...)
+    benchmark::Initialize(&argc, argv);
+
+    if(argc != 4 && argc != 5)
+    {
+        cerr << endl << "Usage: ./orb_slam2_bench path_to_vocabulary path_to_settings path_to_sequence [max_frames] [--benchmark_...]" << endl;
+        return 1;
+    }
+
+    const int nMaxFrames = argc==5 ? atoi(argv[4]) : 20;
+    ORB_SLAM2::BenchFixture::SetPaths(argv[1],argv[2],argv[3],nMaxFrames);
+
+    benchmark::RunSpecifiedBenchmarks();
+
+    return 0;
+}
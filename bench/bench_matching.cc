@@ -0,0 +1,229 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// ORBmatcher search variants
+
+#include <benchmark/benchmark.h>
+
+#include "bench_fixture.h"
+#include "ORBmatcher.h"
+#include "MapPoint.h"
+
+using namespace std;
+using namespace ORB_SLAM2;
+
+// Last two keyframes of the fixture, they share most of their MapPoints
+static void GetKeyFramePair(BenchFixture &fixture, KeyFrame* &pKF1, KeyFrame* &pKF2)
+{
+    const size_t n = fixture.mvpKeyFrames.size();
+    pKF1 = fixture.mvpKeyFrames[n-2];
+    pKF2 = fixture.mvpKeyFrames[n-1];
+}
+
+// Same as LocalMapping::ComputeF12
+static cv::Mat ComputeF12(KeyFrame* pKF1, KeyFrame* pKF2)
+{
+    cv::Mat R1w = pKF1->GetRotation();
+    cv::Mat t1w = pKF1->GetTranslation();
+    cv::Mat R2w = pKF2->GetRotation();
+    cv::Mat t2w = pKF2->GetTranslation();
+
+    cv::Mat R12 = R1w*R2w.t();
+    cv::Mat t12 = -R1w*R2w.t()*t2w+t1w;
+
+    cv::Mat t12x = (cv::Mat_<float>(3,3) <<             0, -t12.at<float>(2), t12.at<float>(1),
+                                          t12.at<float>(2),                0, -t12.at<float>(0),
+                                         -t12.at<float>(1),  t12.at<float>(0),               0);
+
+    return pKF1->mK.t().inv()*t12x*R12*pKF2->mK.inv();
+}
+
+static void BM_SearchByProjection_LastFrame(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    const size_t n = fixture.mvFrames.size();
+    const Frame &LastFrame = fixture.mvFrames[n-2];
+    Frame F(fixture.mvFrames[n-1]);
+    int nMatches = 0;
+    for(auto _ : state)
+    {
+        fill(F.mvpMapPoints.begin(),F.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+        ORBmatcher matcher(0.9,true);
+        nMatches = matcher.SearchByProjection(F,LastFrame,15,false);
+    }
+    state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByProjection_LastFrame)->Unit(benchmark::kMicrosecond);
+
+static void BM_SearchByProjection_LocalMap(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    Frame F(fixture.mvFrames.back());
+    vector<MapPoint*> vpLocalMapPoints = fixture.mpMap->GetAllMapPoints();
+    for(size_t i=0; i<vpLocalMapPoints.size(); i++)
+        F.isInFrustum(vpLocalMapPoints[i],0.5);
+
+    int nMatches = 0;
+    for(auto _ : state)
+    {
+        fill(F.mvpMapPoints.begin(),F.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+        ORBmatcher matcher(0.8);
+        nMatches = matcher.SearchByProjection(F,vpLocalMapPoints,1);
+    }
+    state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByProjection_LocalMap)->Unit(benchmark::kMicrosecond);
+
+static void BM_SearchByProjection_KeyFrame(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    KeyFrame *pKF1, *pKF2;
+    GetKeyFramePair(fixture,pKF1,pKF2);
+    Frame F(fixture.mvFrames.back());
+    const set<MapPoint*> sAlreadyFound;
+    int nMatches = 0;
+    for(auto _ : state)
+    {
+        fill(F.mvpMapPoints.begin(),F.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+        ORBmatcher matcher(0.9,true);
+        nMatches = matcher.SearchByProjection(F,pKF1,sAlreadyFound,10,100);
+    }
+    state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByProjection_KeyFrame)->Unit(benchmark::kMicrosecond);
+
+static void BM_SearchByProjection_Sim3(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    KeyFrame *pKF1, *pKF2;
+    GetKeyFramePair(fixture,pKF1,pKF2);
+    const cv::Mat Scw = pKF2->GetPose();
+    const vector<MapPoint*> vpPoints = pKF1->GetMapPointMatches();
+    vector<MapPoint*> vpMatched;
+    int nMatches = 0;
+    for(auto _ : state)
+    {
+        vpMatched.assign(pKF2->N,static_cast<MapPoint*>(NULL));
+        ORBmatcher matcher(0.75,true);
+        nMatches = matcher.SearchByProjection(pKF2,Scw,vpPoints,vpMatched,10);
+    }
+    state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByProjection_Sim3)->Unit(benchmark::kMicrosecond);
+
+static void BM_SearchByBoW_Frame(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    KeyFrame *pKF1, *pKF2;
+    GetKeyFramePair(fixture,pKF1,pKF2);
+    Frame F(fixture.mvFrames.back());
+    vector<MapPoint*> vpMatches;
+    int nMatches = 0;
+    for(auto _ : state)
+    {
+        ORBmatcher matcher(0.75,true);
+        nMatches = matcher.SearchByBoW(pKF1,F,vpMatches);
+    }
+    state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByBoW_Frame)->Unit(benchmark::kMicrosecond);
+
+static void BM_SearchByBoW_KeyFrame(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    KeyFrame *pKF1, *pKF2;
+    GetKeyFramePair(fixture,pKF1,pKF2);
+    vector<MapPoint*> vpMatches12;
+    int nMatches = 0;
+    for(auto _ : state)
+    {
+        ORBmatcher matcher(0.75,true);
+        nMatches = matcher.SearchByBoW(pKF2,pKF1,vpMatches12);
+    }
+    state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByBoW_KeyFrame)->Unit(benchmark::kMicrosecond);
+
+static void BM_SearchForInitialization(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    const size_t n = fixture.mvFrames.size();
+    Frame F1(fixture.mvFrames[n-2]);
+    Frame F2(fixture.mvFrames[n-1]);
+    vector<cv::Point2f> vbPrevMatchedIni(F1.mvKeysUn.size());
+    for(size_t i=0; i<F1.mvKeysUn.size(); i++)
+        vbPrevMatchedIni[i] = F1.mvKeysUn[i].pt;
+
+    vector<cv::Point2f> vbPrevMatched;
+    vector<int> vnMatches12;
+    int nMatches = 0;
+    for(auto _ : state)
+    {
+        vbPrevMatched = vbPrevMatchedIni;
+        ORBmatcher matcher(0.9,true);
+        nMatches = matcher.SearchForInitialization(F1,F2,vbPrevMatched,vnMatches12,100);
+    }
+    state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchForInitialization)->Unit(benchmark::kMicrosecond);
+
+static void BM_SearchForTriangulation(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    KeyFrame *pKF1, *pKF2;
+    GetKeyFramePair(fixture,pKF1,pKF2);
+    const cv::Mat F12 = ComputeF12(pKF2,pKF1);
+    vector<pair<size_t,size_t> > vMatchedIndices;
+    for(auto _ : state)
+    {
+        vMatchedIndices.clear();
+        ORBmatcher matcher(0.6,false);
+        matcher.SearchForTriangulation(pKF2,pKF1,F12,vMatchedIndices,false);
+    }
+    state.counters["matches"] = vMatchedIndices.size();
+}
+BENCHMARK(BM_SearchForTriangulation)->Unit(benchmark::kMicrosecond);
+
+static void BM_SearchBySim3(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    KeyFrame *pKF1, *pKF2;
+    GetKeyFramePair(fixture,pKF1,pKF2);
+
+    vector<MapPoint*> vpMatchesIni;
+    ORBmatcher matcherBoW(0.75,true);
+    matcherBoW.SearchByBoW(pKF2,pKF1,vpMatchesIni);
+
+    // Relative transformation from the fixture poses (s=1 in stereo)
+    const cv::Mat T21 = pKF2->GetPose()*pKF1->GetPoseInverse();
+    const cv::Mat R21 = T21.rowRange(0,3).colRange(0,3);
+    const cv::Mat t21 = T21.rowRange(0,3).col(3);
+
+    vector<MapPoint*> vpMatches12;
+    int nMatches = 0;
+    for(auto _ : state)
+    {
+        vpMatches12 = vpMatchesIni;
+        ORBmatcher matcher(0.75,true);
+        nMatches = matcher.SearchBySim3(pKF2,pKF1,vpMatches12,1.0f,R21,t21,7.5);
+    }
+    state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchBySim3)->Unit(benchmark::kMicrosecond);
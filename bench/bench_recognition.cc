@@ -0,0 +1,59 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Place recognition queries
+
+#include <benchmark/benchmark.h>
+
+#include "bench_fixture.h"
+
+using namespace std;
+using namespace ORB_SLAM2;
+
+static void BM_DetectRelocalizationCandidates(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    Frame F(fixture.mvFrames.back());
+    size_t nCandidates = 0;
+    for(auto _ : state)
+    {
+        nCandidates = fixture.mpKeyFrameDB->DetectRelocalizationCandidates(&F).size();
+    }
+    state.counters["candidates"] = nCandidates;
+}
+BENCHMARK(BM_DetectRelocalizationCandidates)->Unit(benchmark::kMicrosecond);
+
+static void BM_DetectLoopCandidates(benchmark::State &state)
+{
+    BenchFixture &fixture = BenchFixture::Get();
+    // A revisit of the start of the sequence: a keyframe from the first images that is not
+    // connected to the map, so the keyframes it overlaps with are loop candidates
+    Frame F = fixture.MakeFrame(0);
+    F.ComputeBoW();
+    KeyFrame* pKF = new KeyFrame(F,fixture.mpMap,fixture.mpKeyFrameDB);
+    size_t nCandidates = 0;
+    for(auto _ : state)
+    {
+        nCandidates = fixture.mpKeyFrameDB->DetectLoopCandidates(pKF,0).size();
+    }
+    state.counters["candidates"] = nCandidates;
+    delete pKF;
+}
+BENCHMARK(BM_DetectLoopCandidates)->Unit(benchmark::kMicrosecond);
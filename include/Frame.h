@@ -31,6 +31,7 @@
 #include "ORBextractor.h"
 
 #include <opencv2/opencv.hpp>
+#include <atomic>
 
 namespace ORB_SLAM2
 {
@@ -48,6 +49,9 @@ public:
     // Copy constructor.
     Frame(const Frame &frame);
 
+    // Exchange the contents with another frame without copying keypoints, descriptors or the grid.
+    void Swap(Frame &frame);
+
     // Constructor for stereo cameras.
     Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
 
@@ -83,6 +87,10 @@ public:
     // and fill variables of the MapPoint to be used by the tracking
     bool isInFrustum(MapPoint* pMP, float viewingCosLimit);
 
+    // Same check for a set of MapPoints, run over a dense copy of their geometry.
+    // Returns the number of points in the frustum.
+    int isInFrustum(const std::vector<MapPoint*> &vpMPs, float viewingCosLimit, std::vector<bool> &vbInFrustum);
+
     // Compute the cell of a keypoint (return false if outside the grid)
     bool PosInGrid(const cv::KeyPoint &kp, int &posX, int &posY);
 
@@ -163,8 +171,8 @@ public:
     // Camera pose.
     cv::Mat mTcw;
 
-    // Current and Next Frame id.
-    static long unsigned int nNextId;
+    // Current and Next Frame id (atomic: the pipelined front-end builds frames on its own thread).
+    static std::atomic<long unsigned int> nNextId;
     long unsigned int mnId;
 
     // Reference Keyframe.
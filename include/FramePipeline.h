@@ -0,0 +1,105 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAMEPIPELINE_H
+#define FRAMEPIPELINE_H
+
+#include "Frame.h"
+
+#include <list>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM2
+{
+
+class System;
+class Tracking;
+
+// Two-stage front-end. The extraction thread builds the Frame of the next image (ORB extraction,
+// stereo matching) while the tracking thread runs Track() on the previous one, so the throughput
+// is close to max(extraction, tracking) instead of their sum. Frames are tracked in submission order.
+class FramePipeline
+{
+public:
+    FramePipeline(System* pSys, Tracking* pTracker, const int sensor);
+
+    // Queue an image for tracking. imB is the right image (stereo), the depthmap (RGB-D) or empty
+    // (monocular). Images are not copied: do not modify them until the returned pose is ready.
+    // Blocks if the extraction stage is already full.
+    std::future<cv::Mat> Submit(const cv::Mat &imA, const cv::Mat &imB, const double &timestamp);
+
+    // Main functions of the extraction and tracking threads
+    void RunExtraction();
+    void RunTracking();
+
+    // Frames already submitted are processed before the threads finish.
+    void RequestFinish();
+    bool isFinished();
+
+    // Called by the tracking thread after a reset (which restarts Frame::nNextId). The frame being
+    // tracked takes id 0 and the frames already extracted are renumbered after it, in order.
+    void RestartFrameIds(Frame &frame);
+
+protected:
+
+    struct InputJob
+    {
+        cv::Mat imA;
+        cv::Mat imB;
+        double timestamp;
+        std::promise<cv::Mat> pose;
+    };
+
+    struct ExtractedJob
+    {
+        Frame frame;
+        cv::Mat imGray;
+        std::promise<cv::Mat> pose;
+    };
+
+    System* mpSystem;
+    Tracking* mpTracker;
+    int mSensor;
+
+    // Maximum number of jobs waiting in each stage
+    const size_t mnMaxInput;
+    const size_t mnMaxExtracted;
+
+    std::list<InputJob> mlInput;
+    std::list<ExtractedJob> mlExtracted;
+
+    // Incremented by RestartFrameIds. A frame extracted across a restart is renumbered when queued.
+    unsigned long mnFrameIdRestarts;
+
+    bool mbFinishRequested;
+    bool mbExtractionFinished;
+    bool mbTrackingFinished;
+
+    std::mutex mMutexQueue;
+    std::condition_variable mCondInput;
+    std::condition_variable mCondExtracted;
+};
+
+} //namespace ORB_SLAM
+
+#endif // FRAMEPIPELINE_H
@@ -0,0 +1,81 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <opencv2/core/core.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace ORB_SLAM2
+{
+
+// Reads the images of a dataset sequence ahead of time with a pool of threads, so that
+// dataset replays are not limited by cv::imread. Images are handed out in sequence order.
+class ImageLoader
+{
+public:
+
+    // vstrImagesRight can be empty (monocular). For RGB-D pass the depth maps as right images.
+    // At most nMaxAhead images (or image pairs) are kept in memory.
+    ImageLoader(const std::vector<std::string> &vstrImages, const std::vector<std::string> &vstrImagesRight,
+                const int nThreads=2, const int nMaxAhead=8, const int flags=-1);
+
+    ~ImageLoader();
+
+    // Returns the images with index idx, waiting until they are loaded.
+    // Indices must be requested in increasing order. Returns false if idx is out of the sequence.
+    // Images are empty if they could not be read.
+    bool GetImages(const size_t idx, cv::Mat &im, cv::Mat &imRight);
+
+protected:
+
+    // Main function of the loader threads
+    void Run();
+
+    std::vector<std::string> mvstrImages;
+    std::vector<std::string> mvstrImagesRight;
+    int mFlags;
+    size_t mnMaxAhead;
+
+    // Next index to read and next index the consumer will ask for
+    size_t mnNextToLoad;
+    size_t mnNextToGet;
+
+    std::map<size_t, std::pair<cv::Mat,cv::Mat> > mmLoaded;
+
+    bool mbFinishRequested;
+
+    std::mutex mMutex;
+    std::condition_variable mCondLoaded;
+    std::condition_variable mCondSpace;
+
+    std::vector<std::thread> mvThreads;
+};
+
+} //namespace ORB_SLAM
+
+#endif // IMAGELOADER_H
@@ -28,8 +28,11 @@
 #include "ORBextractor.h"
 #include "Frame.h"
 #include "KeyFrameDatabase.h"
+#include "MapTiles.h"
 
 #include <mutex>
+#include <memory>
+#include <atomic>
 
 
 namespace ORB_SLAM2
@@ -39,6 +42,17 @@ class Map;
 class MapPoint;
 class Frame;
 class KeyFrameDatabase;
+class KeyFrame;
+
+// Covisible keyframes sorted by decreasing weight. A published list is never modified,
+// readers hold a reference to it instead of copying it under the connections mutex.
+struct CovisibilityList
+{
+    std::vector<KeyFrame*> vpKeyFrames;
+    std::vector<int> vWeights;
+};
+
+typedef std::shared_ptr<const CovisibilityList> CovisibilityListPtr;
 
 class KeyFrame
 {
@@ -57,6 +71,15 @@ public:
     // Bag of Words Representation
     void ComputeBoW();
 
+    // Matching data (descriptors, grid and feature vector). The data of keyframes not used recently
+    // can be written to disk (see Map::EnforceKeyFrameBudget), code reading it must pin the keyframe
+    // first (see KeyFramePayloadPin). Pinning reloads the data if needed.
+    void PinPayload();
+    void UnpinPayload();
+    bool SpillPayload(MapTiles* pTiles);
+    bool isPayloadSpilled();
+    long unsigned int GetLastPayloadAccess();
+
     // Covisibility graph functions
     void AddConnection(KeyFrame* pKF, const int &weight);
     void EraseConnection(KeyFrame* pKF);
@@ -66,6 +89,7 @@ public:
     std::vector<KeyFrame* > GetVectorCovisibleKeyFrames();
     std::vector<KeyFrame*> GetBestCovisibilityKeyFrames(const int &N);
     std::vector<KeyFrame*> GetCovisiblesByWeight(const int &w);
+    CovisibilityListPtr GetCovisibilityList();
     int GetWeight(KeyFrame* pKF);
 
     // Spanning tree functions
@@ -140,14 +164,6 @@ public:
     long unsigned int mnBALocalForKF;
     long unsigned int mnBAFixedForKF;
 
-    // Variables used by the keyframe database
-    long unsigned int mnLoopQuery;
-    int mnLoopWords;
-    float mLoopScore;
-    long unsigned int mnRelocQuery;
-    int mnRelocWords;
-    float mRelocScore;
-
     // Variables used by loop closing
     cv::Mat mTcwGBA;
     cv::Mat mTcwBefGBA;
@@ -160,15 +176,15 @@ public:
     const int N;
 
     // KeyPoints, stereo coordinate and descriptors (all associated by an index)
-    const std::vector<cv::KeyPoint> mvKeys;
+    const std::vector<cv::KeyPoint> mvKeys; // empty if there is no distortion (same as mvKeysUn)
     const std::vector<cv::KeyPoint> mvKeysUn;
     const std::vector<float> mvuRight; // negative value for monocular points
     const std::vector<float> mvDepth; // negative value for monocular points
-    const cv::Mat mDescriptors;
+    cv::Mat mDescriptors; // released while spilled
 
     //BoW
     DBoW2::BowVector mBowVec;
-    DBoW2::FeatureVector mFeatVec;
+    DBoW2::FeatureVector mFeatVec; // released while spilled
 
     // Pose relative to parent (this is computed when bad flag is activated)
     cv::Mat mTcp;
@@ -206,13 +222,31 @@ protected:
     KeyFrameDatabase* mpKeyFrameDB;
     ORBVocabulary* mpORBvocabulary;
 
-    // Grid over the image to speed up feature matching
-    std::vector< std::vector <std::vector<size_t> > > mGrid;
+    // Grid over the image to speed up feature matching, stored compactly: the keypoints of cell
+    // (ix,iy) are mvGridIndices[mvGridCellStarts[c]] to mvGridIndices[mvGridCellStarts[c+1]-1],
+    // with c = ix*mnGridRows+iy (released while spilled)
+    std::vector<unsigned int> mvGridCellStarts;
+    std::vector<unsigned int> mvGridIndices;
+
+    // Spilled matching data
+    void LoadPayload();
+    bool mbPayloadSpilled;
+    MapTiles* mpPayloadTiles; // NULL until written
+    MapTiles::Record mPayloadRecord;
+    int mnPayloadPins;
+    long unsigned int mnLastPayloadAccess;
+    static std::atomic<long unsigned int> nPayloadClock;
 
     std::map<KeyFrame*,int> mConnectedKeyFrameWeights;
     std::vector<KeyFrame*> mvpOrderedConnectedKeyFrames;
     std::vector<int> mvOrderedWeights;
 
+    // Last published copy of the ordered connections (see PublishCovisibility)
+    CovisibilityListPtr mpCovisibility;
+
+    // Publishes the ordered connections for the readers. Requires mMutexConnections.
+    void PublishCovisibility();
+
     // Spanning Tree and Loop Edges
     bool mbFirstConnection;
     KeyFrame* mpParent;
@@ -231,6 +265,18 @@ protected:
     std::mutex mMutexPose;
     std::mutex mMutexConnections;
     std::mutex mMutexFeatures;
+    std::mutex mMutexPayload;
+};
+
+// Keeps the matching data of a keyframe in memory while in scope
+class KeyFramePayloadPin
+{
+public:
+    KeyFramePayloadPin(KeyFrame* pKF): mpKF(pKF) { mpKF->PinPayload(); }
+    ~KeyFramePayloadPin() { mpKF->UnpinPayload(); }
+
+private:
+    KeyFrame* mpKF;
 };
 
 } //namespace ORB_SLAM
@@ -28,6 +28,7 @@
 #include "KeyFrame.h"
 #include "Frame.h"
 #include "ORBVocabulary.h"
+#include "ReadWriteMutex.h"
 
 #include<mutex>
 
@@ -57,16 +58,50 @@ public:
    // Relocalization
    std::vector<KeyFrame*> DetectRelocalizationCandidates(Frame* F);
 
+   // Maximum number of keyframes scored by a query
+   static const int MAX_SCORED_CANDIDATES;
+
 protected:
 
+  // Entry of the inverted file
+  struct Posting
+  {
+      unsigned int id; // keyframe id
+      float weight;    // weight of the word in the keyframe
+  };
+
+  // Accumulates, for the keyframes in the database sharing words with a bow vector, the
+  // number of shared words and the L1 score. Query words are processed by decreasing weight.
+  // Once the query weight left cannot lift an unseen keyframe over the best
+  // MAX_SCORED_CANDIDATES partial scores, no more keyframes are admitted.
+  // Keyframes flagged in vbExcluded are skipped. vnCommonWords and vScores are indexed by
+  // keyframe id. vpKFsSharingWords gets the admitted keyframes in the order they were found.
+  void ScanInvertedFile(const DBoW2::BowVector &BowVec, const std::vector<bool> &vbExcluded,
+                        std::vector<int> &vnCommonWords, std::vector<float> &vScores,
+                        std::vector<KeyFrame*> &vpKFsSharingWords);
+
+  // Keeps the MAX_SCORED_CANDIDATES keyframes of vScoreAndMatch with highest score
+  void KeepBestScores(std::vector<std::pair<float,KeyFrame*> > &vScoreAndMatch);
+
   // Associated vocabulary
   const ORBVocabulary* mpVoc;
 
-  // Inverted file
-  std::vector<list<KeyFrame*> > mvInvertedFile;
+  // Scores are accumulated from the inverted file when the vocabulary scores with the L1
+  // norm, otherwise they are computed with the vocabulary
+  bool mbL1Scoring;
+
+  // Inverted file: keyframes that contain each word. Entries of erased
+  // keyframes are left as tombstones until the list is compacted
+  std::vector<std::vector<Posting> > mvInvertedFile;
+  std::vector<int> mvnTombstones;
+
+  // Keyframes in the database indexed by id (NULL if erased or never added)
+  std::vector<KeyFrame*> mvpKeyFrames;
 
-  // Mutex
-  std::mutex mMutex;
+  // Queries scan the inverted file under shared ownership and keep their
+  // counters and scores privately, so they run concurrently with each other.
+  // add, erase and clear take exclusive ownership
+  ReadWriteMutex mMutex;
 };
 
 } //namespace ORB_SLAM
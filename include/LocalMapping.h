@@ -28,6 +28,12 @@
 #include "KeyFrameDatabase.h"
 
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <Eigen/Core>
 
 
 namespace ORB_SLAM2
@@ -62,10 +68,20 @@ public:
     void SetAcceptKeyFrames(bool flag);
     bool SetNotStop(bool flag);
 
+    // Block until Local Mapping has effectively stopped (also when it has finished)
+    void WaitUntilStopped();
+
+    // True if not stopped and waiting for new keyframes, with an empty queue
+    bool isIdle();
+
+    // Block until Local Mapping is idle (or has finished)
+    void WaitUntilIdle();
+
     void InterruptBA();
 
     void RequestFinish();
     bool isFinished();
+    void WaitUntilFinished();
 
     int KeyframesInQueue(){
         unique_lock<std::mutex> lock(mMutexNewKFs);
@@ -75,14 +91,37 @@ public:
 protected:
 
     bool CheckNewKeyFrames();
+    bool CheckResetRequested();
     void ProcessNewKeyFrame();
     void CreateNewMapPoints();
 
+    // Point triangulated from a match between the current keyframe (idx1) and a neighbor (idx2)
+    struct TriangulatedPoint
+    {
+        int idx1;
+        int idx2;
+        Eigen::Vector3f x3D;
+    };
+
+    // Triangulates the matches of the current keyframe with neighbor i. CreateNewMapPoints runs it
+    // for all neighbors in several threads at once, the map is only modified afterwards.
+    void TriangulateNeighbor(const int i);
+
     void MapPointCulling();
     void SearchInNeighbors();
 
+    // MapPoints per job when fusing and updating them in parallel
+    static const size_t FUSE_BLOCK_SIZE;
+
+    // Runs job(i) for i in [0,nJobs) on up to 4 threads, this one included
+    static void RunParallel(const int nJobs, const std::function<void(int)> &job);
+
     void KeyFrameCulling();
 
+    // True if 90% of the close MapPoints seen by pKF are seen in at least 3 other keyframes.
+    // Only reads the map, KeyFrameCulling runs it in parallel.
+    bool IsRedundant(KeyFrame* pKF);
+
     cv::Mat ComputeF12(KeyFrame* &pKF1, KeyFrame* &pKF2);
 
     cv::Mat SkewSymmetricMatrix(const cv::Mat &v);
@@ -105,11 +144,19 @@ protected:
     Tracking* mpTracker;
 
     std::list<KeyFrame*> mlNewKeyFrames;
+    // Insertion time of the queued keyframes, to measure the hand-off from Tracking
+    std::list<std::chrono::steady_clock::time_point> mlNewKeyFrameTimes;
 
     KeyFrame* mpCurrentKeyFrame;
 
     std::list<MapPoint*> mlpRecentAddedMapPoints;
 
+    // Neighbors to triangulate with and the points triangulated with each one. Neighbors are
+    // taken in order, mnTriangulationEnd is lowered to skip the rest when a new keyframe arrives.
+    std::vector<KeyFrame*> mvpTriangulationKFs;
+    std::vector<std::vector<TriangulatedPoint> > mvvTriangulatedPoints;
+    std::atomic<int> mnTriangulationEnd;
+
     std::mutex mMutexNewKFs;
 
     bool mbAbortBA;
@@ -121,6 +168,13 @@ protected:
 
     bool mbAcceptKeyFrames;
     std::mutex mMutexAccept;
+
+    // Waiting threads (this one when idle or stopped, others waiting for a stop, reset or finish)
+    // sleep on mcvWakeUp. Every change of the state they wait for calls WakeUp() once its own mutex
+    // has been released, as the waiting conditions take those mutexes under mMutexWakeUp.
+    void WakeUp();
+    std::mutex mMutexWakeUp;
+    std::condition_variable mcvWakeUp;
 };
 
 } //namespace ORB_SLAM
@@ -31,6 +31,8 @@
 
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
 namespace ORB_SLAM2
@@ -57,6 +59,10 @@ public:
 
     void SetLocalMapper(LocalMapping* pLocalMapper);
 
+    // In deterministic mode the Global BA after a loop closure does not run concurrently
+    // with mapping and tracking, this thread waits until it has finished.
+    void SetDeterministic(const bool flag);
+
     // Main function
     void Run();
 
@@ -76,24 +82,56 @@ public:
         return mbFinishedGBA;
     }   
 
+    // Iterations done by the running (or last) Global BA
+    int GetGlobalBAIteration(){
+        return mnGBAIteration;
+    }
+
     void RequestFinish();
 
     bool isFinished();
 
+    // Block until this thread and the Global BA (if running) have finished
+    void WaitUntilFinished();
+
+    // True if there are no keyframes queued nor being processed (Global BA may still be running)
+    bool isIdle();
+
+    // Block until this thread is idle (or has finished)
+    void WaitUntilIdle();
+
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
 protected:
 
     bool CheckNewKeyFrames();
+    bool CheckResetRequested();
 
     bool DetectLoop();
 
     bool ComputeSim3();
 
+    // Takes loop candidates until one of them gets a valid Sim3 or none is left.
+    // ComputeSim3 runs it in several threads at once, the first candidate with a valid
+    // Sim3 wins and the other threads give up their candidates.
+    void RunSim3Worker();
+
     void SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap);
 
     void CorrectLoop();
 
+    // Stops a running Global BA. The estimate it reached is kept to be merged by CorrectLoop.
+    void StopGlobalBundleAdjustment();
+
+    // Write the Global BA estimate to the map, correcting also keyframes and points created meanwhile.
+    // Requires Local Mapping stopped. The map update mutex is taken in chunks so tracking is not blocked.
+    void MergeGlobalBundleAdjustment(unsigned long nLoopKF);
+
+    // Write the essential graph solution to the map. Requires Local Mapping stopped and the map update mutex.
+    void ApplyEssentialGraph(const std::vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vScw,
+                             const std::vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vCorrectedSiw,
+                             const std::vector<bool> &vbOptimized);
+
     void ResetIfRequested();
     bool mbResetRequested;
     std::mutex mMutexReset;
@@ -104,6 +142,12 @@ protected:
     bool mbFinished;
     std::mutex mMutexFinish;
 
+    // This thread sleeps on mcvWakeUp when idle, as the threads waiting for a reset or finish do.
+    // State changes call WakeUp() after releasing their own mutex.
+    void WakeUp();
+    std::mutex mMutexWakeUp;
+    std::condition_variable mcvWakeUp;
+
     Map* mpMap;
     Tracking* mpTracker;
 
@@ -113,6 +157,7 @@ protected:
     LocalMapping *mpLocalMapper;
 
     std::list<KeyFrame*> mlpLoopKeyFrameQueue;
+    bool mbProcessingKeyFrame;
 
     std::mutex mMutexLoopQueue;
 
@@ -130,6 +175,12 @@ protected:
     cv::Mat mScw;
     g2o::Sim3 mg2oScw;
 
+    // Sim3 candidate evaluation shared by the workers
+    std::atomic<int> mnNextSim3Candidate;
+    std::atomic<int> mnSim3Winner; // -1 until a candidate succeeds
+    std::vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > mvSim3Scm;
+    std::vector<std::vector<MapPoint*> > mvvpSim3Matches;
+
     long unsigned int mLastLoopKFid;
 
     // Variables related to Global Bundle Adjustment
@@ -138,12 +189,20 @@ protected:
     bool mbStopGBA;
     std::mutex mMutexGBA;
     std::thread* mpThreadGBA;
+    std::atomic<int> mnGBAIteration;
+
+    // Map points corrected per lock of the map when merging a Global BA
+    static const size_t GBA_MERGE_CHUNK;
+
+    // Set when a Global BA was stopped by a new loop after some iterations. Its estimate is
+    // merged before correcting the new loop, so the next Global BA starts from it.
+    bool mbPendingGBAMerge;
+    unsigned long mnPendingGBALoopKF;
 
     // Fix scale in the stereo/RGB-D case
     bool mbFixScale;
 
-
-    bool mnFullBAIdx;
+    bool mbDeterministic;
 };
 
 } //namespace ORB_SLAM
@@ -23,7 +23,9 @@
 
 #include "MapPoint.h"
 #include "KeyFrame.h"
+#include "MapTiles.h"
 #include <set>
+#include <string>
 
 #include <mutex>
 
@@ -39,6 +41,7 @@ class Map
 {
 public:
     Map();
+    ~Map();
 
     void AddKeyFrame(KeyFrame* pKF);
     void AddMapPoint(MapPoint* pMP);
@@ -64,6 +67,18 @@ public:
 
     void clear();
 
+    // Keeps the matching data of at most nMaxResident keyframes in memory (0 disables it). The rest
+    // is stored in spatial tiles of tileSize under strDir (see MapTiles) and reloaded when a keyframe
+    // is matched again. Keyframes in tiles away from the camera are evicted first, then the least
+    // recently used. The local window of the tracking is prefetched and never evicted.
+    void SetKeyFrameBudget(const int nMaxResident, const std::string &strDir, const float tileSize, const int nTileRadius);
+    void SetLocalWindow(const std::vector<KeyFrame*> &vpLocalKFs, const cv::Mat &Ow);
+    void EnforceKeyFrameBudget();
+
+    // Delete the spill tiles (files, descriptors and mappings). Spilled payloads are lost,
+    // only call it once no thread uses the map anymore (System::Shutdown).
+    void ReleaseKeyFrameBudget();
+
     vector<KeyFrame*> mvpKeyFrameOrigins;
 
     std::set<MapPoint *> mspCurrentMapPoints; // Current map points
@@ -74,7 +89,10 @@ public:
     std::mutex mMutexPointCreation;
 
 protected:
-    std::set<MapPoint*> mspMapPoints;
+    // Map points stored contiguously, each point keeps its slot (MapPoint::mnMapSlot) so that
+    // insertion and erasure are O(1) and GetAllMapPoints is a plain copy
+    std::vector<MapPoint*> mvpMapPoints;
+
     std::set<KeyFrame*> mspKeyFrames;
 
     std::vector<MapPoint*> mvpReferenceMapPoints;
@@ -84,6 +102,12 @@ protected:
     // Index related to a big change in the map (loop closure, global BA)
     int mnBigChangeIdx;
 
+    // Keyframe memory budget
+    int mnMaxResidentKeyFrames;
+    MapTiles* mpTiles;
+    std::vector<KeyFrame*> mvpLocalWindow;
+    cv::Mat mCameraCenter;
+
     std::mutex mMutexMap;
 };
 
@@ -27,6 +27,8 @@
 
 #include<opencv2/core/core.hpp>
 #include<mutex>
+#include<atomic>
+#include<stdint.h>
 
 namespace ORB_SLAM2
 {
@@ -48,7 +50,12 @@ public:
     cv::Mat GetNormal();
     KeyFrame* GetReferenceKeyFrame();
 
+    // Position, normal and scale invariance distances (unscaled) read under a single lock
+    void GetGeometry(float *pos, float *normal, float &minDistance, float &maxDistance);
+
     std::map<KeyFrame*,size_t> GetObservations();
+    // Appends the observing keyframes to vpKFs
+    void GetObservingKeyFrames(std::vector<KeyFrame*> &vpKFs);
     int Observations();
 
     void AddObservation(KeyFrame* pKF,size_t idx);
@@ -72,6 +79,10 @@ public:
 
     void ComputeDistinctiveDescriptors();
 
+    // Drop the descriptor distances cached by ComputeDistinctiveDescriptors. Tracking calls it
+    // when the point leaves its local map, so that the cache is only kept for local points.
+    void ClearDescriptorCache();
+
     cv::Mat GetDescriptor();
 
     void UpdateNormalAndDepth();
@@ -109,6 +120,9 @@ public:
     cv::Mat mPosGBA;
     long unsigned int mnBAGlobalForKF;
 
+    // Slot in the map point storage of the Map (-1 if not in the map), managed by the Map
+    long int mnMapSlot;
+
 
     static std::mutex mGlobalMutex;
 
@@ -130,11 +144,11 @@ protected:
      KeyFrame* mpRefKF;
 
      // Tracking counters
-     int mnVisible;
-     int mnFound;
+     std::atomic<int> mnVisible;
+     std::atomic<int> mnFound;
 
      // Bad flag (we do not currently erase MapPoint from memory)
-     bool mbBad;
+     std::atomic<bool> mbBad;
      MapPoint* mpReplaced;
 
      // Scale invariance distances
@@ -143,8 +157,38 @@ protected:
 
      Map* mpMap;
 
+     static const int DESCRIPTOR_WORDS = 8;
+
+     // Observations (sorted by keyframe) the distinctive descriptor was last chosen from, with a
+     // copy of their descriptor, and their pairwise distances (upper triangle, see PairIndex)
+     struct DescriptorObservation
+     {
+         KeyFrame* pKF;
+         size_t idx;
+         uint32_t descriptor[DESCRIPTOR_WORDS];
+     };
+     std::vector<DescriptorObservation> mvDescriptorObs;
+     std::vector<unsigned short> mvDescriptorDistances;
+
+     static inline size_t PairIndex(const size_t i, const size_t j, const size_t N){
+         return i*(2*N-i-1)/2+(j-i-1);
+     }
+
+     // Copies of position, normal, scale invariance distances and descriptor read without locks.
+     // Each copy is guarded by a sequence counter (odd while being written). The geometry is
+     // published under mMutexPos and the descriptor under mMutexFeatures.
+     std::atomic<unsigned int> mnGeometrySeq;
+     std::atomic<float> mafGeometry[8]; // position, normal, min and max distance
+     std::atomic<unsigned int> mnDescriptorSeq;
+     std::atomic<uint32_t> manDescriptor[DESCRIPTOR_WORDS];
+
+     void PublishGeometry();
+     void PublishDescriptor();
+     void ReadGeometry(float *geometry);
+
      std::mutex mMutexPos;
      std::mutex mMutexFeatures;
+     std::mutex mMutexDescriptors;
 };
 
 } //namespace ORB_SLAM
@@ -0,0 +1,98 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPTILES_H
+#define MAPTILES_H
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+#include <map>
+#include <string>
+#include <mutex>
+
+namespace ORB_SLAM2
+{
+
+// Out-of-core storage of keyframe data, partitioned in cubic spatial tiles of the map.
+// Data is appended to one file per tile and read back through a read-only memory mapping
+// of the file. Only the tiles around the current camera position stay mapped.
+class MapTiles
+{
+public:
+    // Location of a stored block
+    struct Record
+    {
+        int nTile;
+        size_t offset;
+        size_t size;
+    };
+
+    // A tileSize of 0 puts the whole map in a single tile
+    MapTiles(const std::string &strDir, const float tileSize, const int nRadius);
+    ~MapTiles();
+
+    // Appends data to the tile containing position Pw
+    bool Write(const cv::Mat &Pw, const std::string &data, Record &record);
+
+    // Copies a stored block, mapping its tile if needed
+    bool Read(const Record &record, std::string &data);
+
+    // Unmaps the tiles farther than the radius (in tiles) from the tile of the camera
+    void SetCameraPosition(const cv::Mat &Ow);
+
+    // True if position Pw is within the radius of the camera tile
+    bool IsNearCamera(const cv::Mat &Pw);
+
+    // Removes all stored data
+    void Clear();
+
+protected:
+
+    struct Tile
+    {
+        int x, y, z;
+        std::string strFile;
+        int fd;
+        size_t nSize;
+        char* pMapped;
+        size_t nMapped;
+    };
+
+    void GetTileCoords(const cv::Mat &Pw, int &x, int &y, int &z);
+    bool IsNear(const int x, const int y, const int z);
+    void Unmap(Tile &tile);
+
+    std::string mStrDir;
+    float mTileSize;
+    int mnRadius;
+
+    std::vector<Tile> mvTiles;
+    std::map<std::vector<int>,int> mTileIndices;
+
+    // Tile of the camera
+    int mCamX, mCamY, mCamZ;
+
+    std::mutex mMutexTiles;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPTILES_H
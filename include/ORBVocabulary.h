@@ -22,13 +22,13 @@
 #ifndef ORBVOCABULARY_H
 #define ORBVOCABULARY_H
 
-#include"Thirdparty/DBoW2/DBoW2/FORB.h"
+#include"Thirdparty/DBoW2/DBoW2/FORB256.h"
 #include"Thirdparty/DBoW2/DBoW2/TemplatedVocabulary.h"
 
 namespace ORB_SLAM2
 {
 
-typedef DBoW2::TemplatedVocabulary<DBoW2::FORB::TDescriptor, DBoW2::FORB>
+typedef DBoW2::TemplatedVocabulary<DBoW2::FORB256::TDescriptor, DBoW2::FORB256>
   ORBVocabulary;
 
 } //namespace ORB_SLAM
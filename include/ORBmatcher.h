@@ -23,6 +23,7 @@
 #define ORBMATCHER_H
 
 #include<vector>
+#include<set>
 #include<opencv2/core/core.hpp>
 #include<opencv2/features2d/features2d.hpp>
 
@@ -79,6 +80,16 @@ public:
     // Project MapPoints into KeyFrame and search for duplicated MapPoints.
     int Fuse(KeyFrame* pKF, const vector<MapPoint *> &vpMapPoints, const float th=3.0);
 
+    // Fuse in two steps, so that the search can run in parallel.
+    // SearchFuse finds the keypoint each MapPoint in [begin,end) would be fused with (-1 if none).
+    // It does not modify the map. ApplyFuse then fuses the MapPoints in order, giving the same result
+    // as Fuse. spChanged collects the points that survived a replacement, their descriptor has changed
+    // since the search so they are searched again (pass the same set to consecutive calls).
+    void SearchFuse(KeyFrame* pKF, const vector<MapPoint *> &vpMapPoints, const size_t begin, const size_t end,
+                    std::vector<int> &vnFuseIdx, const float th=3.0);
+    int ApplyFuse(KeyFrame* pKF, const vector<MapPoint *> &vpMapPoints, const std::vector<int> &vnFuseIdx,
+                  std::set<MapPoint*> &spChanged, const float th=3.0);
+
     // Project MapPoints into KeyFrame using a given Sim3 and search for duplicated MapPoints.
     int Fuse(KeyFrame* pKF, cv::Mat Scw, const std::vector<MapPoint*> &vpPoints, float th, vector<MapPoint *> &vpReplacePoint);
 
@@ -91,6 +102,12 @@ public:
 
 protected:
 
+    // Keypoint of pKF (pose given) to fuse pMP with, -1 if none
+    int SearchFuse(KeyFrame* pKF, const cv::Mat &Rcw, const cv::Mat &tcw, const cv::Mat &Ow, MapPoint* pMP, const float th);
+
+    // Fuses pMP with keypoint idx of pKF. Returns the surviving MapPoint if one replaced the other.
+    MapPoint* FuseMapPoint(KeyFrame* pKF, MapPoint* pMP, const int idx);
+
     bool CheckDistEpipolarLine(const cv::KeyPoint &kp1, const cv::KeyPoint &kp2, const cv::Mat &F12, const KeyFrame *pKF);
 
     float RadiusByViewingCos(const float &viewCos);
@@ -29,6 +29,8 @@
 
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
+#include <atomic>
+
 namespace ORB_SLAM2
 {
 
@@ -37,20 +39,30 @@ class LoopClosing;
 class Optimizer
 {
 public:
-    void static BundleAdjustment(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP,
-                                 int nIterations = 5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
-                                 const bool bRobust = true);
-    void static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL,
-                                       const unsigned long nLoopKF=0, const bool bRobust = true);
+    // If pnIteration is given it is updated after every iteration, so the progress can be followed
+    // from another thread. Returns the number of iterations done, which may be less than nIterations
+    // if the stop flag was raised. Stopped or not, the estimate reached is recovered.
+    int static BundleAdjustment(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP,
+                                int nIterations = 5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
+                                const bool bRobust = true, std::atomic<int> *pnIteration=NULL);
+    int static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL,
+                                      const unsigned long nLoopKF=0, const bool bRobust = true,
+                                      std::atomic<int> *pnIteration=NULL);
     void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, Map *pMap);
     int static PoseOptimization(Frame* pFrame);
 
     // if bFixScale is true, 6DoF optimization (stereo,rgbd), 7DoF otherwise (mono)
+    // The map is not modified, so Local Mapping can run meanwhile. vScw gets the pose each keyframe
+    // was optimized from and vCorrectedSiw the optimized pose, indexed by keyframe id.
+    // vbOptimized flags the keyframes that were in the graph.
     void static OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
                                        const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
-                                       const bool &bFixScale);
+                                       const bool &bFixScale,
+                                       std::vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vScw,
+                                       std::vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vCorrectedSiw,
+                                       std::vector<bool> &vbOptimized);
 
     // if bFixScale is true, optimize SE3 (stereo,rgbd), Sim3 otherwise (mono)
     static int OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint *> &vpMatches1,
@@ -0,0 +1,104 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef READWRITEMUTEX_H
+#define READWRITEMUTEX_H
+
+#include<mutex>
+#include<condition_variable>
+
+namespace ORB_SLAM2
+{
+
+// Mutex with shared (reader) and exclusive (writer) ownership. Writers are
+// preferred: once a writer waits, new readers wait too, so a stream of queries
+// cannot starve insertions. lock()/unlock() let it be used with unique_lock.
+class ReadWriteMutex
+{
+public:
+    ReadWriteMutex():mnReaders(0),mnWaitingWriters(0),mbWriter(false){}
+
+    void lock()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mnWaitingWriters++;
+        mcvWriters.wait(lock,[this]{return !mbWriter && mnReaders==0;});
+        mnWaitingWriters--;
+        mbWriter = true;
+    }
+
+    void unlock()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mbWriter = false;
+        }
+        mcvWriters.notify_one();
+        mcvReaders.notify_all();
+    }
+
+    void lock_shared()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mcvReaders.wait(lock,[this]{return !mbWriter && mnWaitingWriters==0;});
+        mnReaders++;
+    }
+
+    void unlock_shared()
+    {
+        bool bNotify;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mnReaders--;
+            bNotify = mnReaders==0 && mnWaitingWriters>0;
+        }
+        if(bNotify)
+            mcvWriters.notify_one();
+    }
+
+private:
+    ReadWriteMutex(const ReadWriteMutex&);
+    ReadWriteMutex& operator=(const ReadWriteMutex&);
+
+    std::mutex mMutex;
+    std::condition_variable mcvReaders;
+    std::condition_variable mcvWriters;
+    int mnReaders;
+    int mnWaitingWriters;
+    bool mbWriter;
+};
+
+// Holds shared ownership of a ReadWriteMutex for its lifetime
+class ReadLock
+{
+public:
+    explicit ReadLock(ReadWriteMutex &m):mMutex(m){ mMutex.lock_shared(); }
+    ~ReadLock(){ mMutex.unlock_shared(); }
+
+private:
+    ReadLock(const ReadLock&);
+    ReadLock& operator=(const ReadLock&);
+
+    ReadWriteMutex &mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // READWRITEMUTEX_H
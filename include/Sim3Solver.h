@@ -24,6 +24,7 @@
 
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <Eigen/Core>
 
 #include "KeyFrame.h"
 
@@ -51,14 +52,16 @@ public:
 
 protected:
 
-    void ComputeCentroid(cv::Mat &P, cv::Mat &Pr, cv::Mat &C);
+    // Points are the columns of the matrices
+    void ComputeCentroid(const Eigen::Matrix3f &P, Eigen::Matrix3f &Pr, Eigen::Vector3f &C);
 
-    void ComputeSim3(cv::Mat &P1, cv::Mat &P2);
+    void ComputeSim3(const Eigen::Matrix3f &P1, const Eigen::Matrix3f &P2);
 
     void CheckInliers();
 
-    void Project(const std::vector<cv::Mat> &vP3Dw, std::vector<cv::Mat> &vP2D, cv::Mat Tcw, cv::Mat K);
-    void FromCameraToImage(const std::vector<cv::Mat> &vP3Dc, std::vector<cv::Mat> &vP2D, cv::Mat K);
+    void Project(const std::vector<Eigen::Vector3f> &vP3Dw, std::vector<Eigen::Vector2f> &vP2D,
+                 const Eigen::Matrix3f &sRcw, const Eigen::Vector3f &tcw, const cv::Mat &K);
+    void FromCameraToImage(const std::vector<Eigen::Vector3f> &vP3Dc, std::vector<Eigen::Vector2f> &vP2D, const cv::Mat &K);
 
 
 protected:
@@ -67,8 +70,8 @@ protected:
     KeyFrame* mpKF1;
     KeyFrame* mpKF2;
 
-    std::vector<cv::Mat> mvX3Dc1;
-    std::vector<cv::Mat> mvX3Dc2;
+    std::vector<Eigen::Vector3f> mvX3Dc1;
+    std::vector<Eigen::Vector3f> mvX3Dc2;
     std::vector<MapPoint*> mvpMapPoints1;
     std::vector<MapPoint*> mvpMapPoints2;
     std::vector<MapPoint*> mvpMatches12;
@@ -81,12 +84,13 @@ protected:
     int N;
     int mN1;
 
-    // Current Estimation
-    cv::Mat mR12i;
-    cv::Mat mt12i;
+    // Current Estimation (T12 = [sR12 t12], T21 = [sR21 t21])
+    Eigen::Matrix3f mR12i;
+    Eigen::Vector3f mt12i;
     float ms12i;
-    cv::Mat mT12i;
-    cv::Mat mT21i;
+    Eigen::Matrix3f msR12i;
+    Eigen::Matrix3f msR21i;
+    Eigen::Vector3f mt21i;
     std::vector<bool> mvbInliersi;
     int mnInliersi;
 
@@ -94,9 +98,8 @@ protected:
     int mnIterations;
     std::vector<bool> mvbBestInliers;
     int mnBestInliers;
-    cv::Mat mBestT12;
-    cv::Mat mBestRotation;
-    cv::Mat mBestTranslation;
+    Eigen::Matrix3f mBestRotation;
+    Eigen::Vector3f mBestTranslation;
     float mBestScale;
 
     // Scale is fixed to 1 in the stereo/RGBD case
@@ -106,8 +109,8 @@ protected:
     std::vector<size_t> mvAllIndices;
 
     // Projections
-    std::vector<cv::Mat> mvP1im1;
-    std::vector<cv::Mat> mvP2im2;
+    std::vector<Eigen::Vector2f> mvP1im1;
+    std::vector<Eigen::Vector2f> mvP2im2;
 
     // RANSAC probability
     double mRansacProb;
@@ -0,0 +1,152 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace ORB_SLAM2
+{
+
+// Latency histogram. Bins are logarithmic (4 per power of two) over microseconds.
+class LatencyHistogram
+{
+public:
+    static const int NBINS = 112;
+
+    LatencyHistogram();
+
+    void Add(const double us);
+    void Merge(const LatencyHistogram &other);
+    void Clear();
+
+    // Percentile p in [0,1] in microseconds, approximated by the upper edge of its bin
+    double Percentile(const double p) const;
+
+    unsigned long mvBins[NBINS];
+    unsigned long mnCount;
+    double mSum;
+    double mMax;
+};
+
+// Summary of a stage. Times in milliseconds.
+struct StageStats
+{
+    std::string name;
+    unsigned long count;
+    double mean;
+    double median;
+    double p90;
+    double p99;
+    double max;
+};
+
+// Always-on latency instrumentation. Every thread records into its own histograms,
+// they are only merged when the statistics are requested.
+class Stats
+{
+public:
+    enum eStage{
+        TRACKING=0,
+        ORB_EXTRACTION,
+        STEREO_MATCHING,
+        TRACK_MOTION_MODEL,
+        TRACK_LOCAL_MAP,
+        POSE_OPTIMIZATION,
+        LOCAL_BA,
+        KEYFRAME_CULLING,
+        DETECT_LOOP,
+        COMPUTE_SIM3,
+        CORRECT_LOOP,
+        GLOBAL_BA,
+        KEYFRAME_HANDOFF,
+        NUM_STAGES
+    };
+
+    static const char* StageName(const eStage stage);
+
+    // Adds a measurement to the histogram of the calling thread
+    static void Record(const eStage stage, const double us);
+
+    // Merges the histograms of all threads (including finished ones)
+    static std::vector<StageStats> GetSummary();
+
+    static void Reset();
+
+    static std::string ToJSON(const std::vector<StageStats> &vStats);
+    static std::string ToCSV(const std::vector<StageStats> &vStats);
+
+    // Writes the current summary as CSV if filename ends in ".csv", JSON otherwise.
+    // The file is replaced atomically so it can be read while running.
+    static bool Save(const std::string &filename);
+};
+
+// Measures the lifetime of the object and records it in the given stage
+class ScopedTimer
+{
+public:
+    ScopedTimer(const Stats::eStage stage): mStage(stage), mtStart(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer()
+    {
+        std::chrono::steady_clock::time_point tEnd = std::chrono::steady_clock::now();
+        Stats::Record(mStage, std::chrono::duration_cast<std::chrono::duration<double,std::micro> >(tEnd-mtStart).count());
+    }
+
+private:
+    Stats::eStage mStage;
+    std::chrono::steady_clock::time_point mtStart;
+};
+
+// Saves the statistics periodically (Stats.DumpFile and Stats.DumpPeriod in the settings file)
+class StatsDumper
+{
+public:
+    StatsDumper(const std::string &filename, const float period);
+
+    // Main function
+    void Run();
+
+    void RequestFinish();
+    bool isFinished();
+    void WaitUntilFinished();
+
+protected:
+
+    void SetFinish();
+    bool mbFinishRequested;
+    bool mbFinished;
+    std::mutex mMutexFinish;
+    std::condition_variable mcvFinish;
+
+    std::string mFilename;
+
+    // Seconds between dumps
+    float mPeriod;
+};
+
+} //namespace ORB_SLAM
+
+#endif // STATS_H
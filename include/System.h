@@ -24,6 +24,7 @@
 
 #include<string>
 #include<thread>
+#include<future>
 #include<opencv2/core/core.hpp>
 
 #include "Tracking.h"
@@ -35,6 +36,8 @@
 #include "KeyFrameDatabase.h"
 #include "ORBVocabulary.h"
 #include "Viewer.h"
+#include "FramePipeline.h"
+#include "Stats.h"
 
 #include <semaphore.h>
 #include <fcntl.h>
@@ -52,6 +55,7 @@ class Map;
 class Tracking;
 class LocalMapping;
 class LoopClosing;
+class FramePipeline;
 
 class System
 {
@@ -85,11 +89,24 @@ public:
     cv::Mat TrackMonocularTCC(const cv::Mat &im, const double &timestamp, sem_t *sem_cons_message, sem_t *sem_prod_message, char *result_message);
     cv::Mat TrackMonocular(const cv::Mat &im, const double &timestamp);
 
+    // Pipelined alternatives to TrackStereo/TrackRGBD/TrackMonocular. They return as soon as the
+    // frame is queued: feature extraction of this frame runs while the previous one is tracked.
+    // Frames are tracked in submission order and the future holds the camera pose (empty if tracking fails).
+    // Images are not copied, do not modify them until the pose is ready. Do not mix with Track* calls.
+    // In deterministic mode (System.Deterministic) frames are tracked synchronously.
+    std::future<cv::Mat> SubmitStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp);
+    std::future<cv::Mat> SubmitRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp);
+    std::future<cv::Mat> SubmitMonocular(const cv::Mat &im, const double &timestamp);
+
     // This stops local mapping thread (map building) and performs only camera tracking.
     void ActivateLocalizationMode();
     // This resumes local mapping thread and performs SLAM again.
     void DeactivateLocalizationMode();
 
+    // Offline mode for dataset replays: tracking waits for Local Mapping and Loop Closing to drain
+    // their queues instead of dropping keyframes when they are busy. Call it before the first frame.
+    void SetOfflineMode(const bool flag);
+
     // Returns true if there have been a big map change (loop closure, global BA)
     // since last call to this function
     bool MapChanged();
@@ -130,11 +147,31 @@ public:
     std::vector<MapPoint*> GetTrackedMapPoints();
     std::vector<cv::KeyPoint> GetTrackedKeyPointsUn();
 
+    // Latency statistics of the main stages (tracking, mapping, loop closing) since the start.
+    // Set Stats.DumpFile (.json or .csv) and Stats.DumpPeriod (seconds) in the settings file
+    // to save them periodically.
+    std::vector<StageStats> GetStats();
+
 private:
 
+    friend class FramePipeline;
+
+    // Apply pending localization mode changes and reset requests before tracking a frame.
+    // Returns true if the system was reset.
+    bool CheckModeChangeAndReset();
+
+    // Called by the pipeline tracking thread
+    cv::Mat TrackExtractedFrame(Frame &frame, const cv::Mat &imGray);
+
+    // Pipelined front-end, created on the first Submit* call
+    FramePipeline* GetFramePipeline();
+
     // Input sensor
     eSensor mSensor;
 
+    // Reproducible execution (System.Deterministic in the settings file)
+    bool mbDeterministic;
+
     // ORB vocabulary used for place recognition and feature matching.
     ORBVocabulary* mpVocabulary;
 
@@ -168,6 +205,19 @@ private:
     std::thread* mptLoopClosing;
     std::thread* mptViewer;
 
+    // Pipelined front-end and its threads (only launched if Submit* is used)
+    FramePipeline* mpFramePipeline;
+    std::thread* mptPipelineExtraction;
+    std::thread* mptPipelineTracking;
+    std::mutex mMutexPipeline;
+
+    // Periodic statistics dump (only launched if Stats.DumpFile is set)
+    StatsDumper* mpStatsDumper;
+    std::thread* mptStatsDumper;
+
+    // Temporary directory of the keyframe spill (only if Map.SpillDirectory is not set)
+    std::string mStrSpillTempDir;
+
     // Reset flag
     std::mutex mMutexReset;
     bool mbReset;
@@ -46,6 +46,7 @@
 #include <fcntl.h>
 
 #include <mutex>
+#include <atomic>
 
 namespace ORB_SLAM2
 {
@@ -70,6 +71,16 @@ public:
     cv::Mat GrabImageMonocular(const cv::Mat &im, const double &timestamp);
     cv::Mat GrabImageMonocularTCC(const cv::Mat &im, const double &timestamp, sem_t *sem_cons_message, sem_t *sem_prod_message, char *result_message);
 
+    // The two halves of GrabImage*, used separately by the pipelined front-end (FramePipeline).
+    // Extract* converts the input to grayscale and builds the Frame (ORB extraction, stereo matching).
+    // It does not modify the tracking state, so it can run while TrackFrame processes the previous frame.
+    Frame ExtractStereo(const cv::Mat &imRectLeft,const cv::Mat &imRectRight, const double &timestamp, cv::Mat &imGray);
+    Frame ExtractRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp, cv::Mat &imGray);
+    Frame ExtractMonocular(const cv::Mat &im, const double &timestamp, cv::Mat &imGray);
+    // Track an already extracted frame. Frames must be given in the order they were extracted.
+    // The frame is swapped into mCurrentFrame, it is left with the contents of the previous one.
+    cv::Mat TrackFrame(Frame &frame, const cv::Mat &imGray);
+
     void SetLocalMapper(LocalMapping* pLocalMapper);
     void SetLoopClosing(LoopClosing* pLoopClosing);
     void SetViewer(Viewer* pViewer);
@@ -82,6 +93,10 @@ public:
     // Use this function if you have deactivated local mapping and you only want to localize the camera.
     void InformOnlyTracking(const bool &flag);
 
+    // Offline mode (dataset replays). Each frame waits until Local Mapping and Loop Closing have
+    // processed the previous keyframes instead of skipping keyframes when they are busy.
+    void SetOfflineMode(const bool &flag);
+
 
 public:
 
@@ -94,7 +109,8 @@ public:
         LOST=3
     };
 
-    eTrackingState mState;
+    // Atomic: the pipelined front-end reads it from the extraction thread
+    std::atomic<eTrackingState> mState;
     eTrackingState mLastProcessedState;
 
     // Input sensor
@@ -121,6 +137,9 @@ public:
     // True if local mapping is deactivated and we are performing only localization
     bool mbOnlyTracking;
 
+    // True if frames come from a dataset and there is no real-time constraint
+    bool mbOffline;
+
     void Reset();
 
 protected:
@@ -153,6 +172,9 @@ protected:
     bool NeedNewKeyFrame();
     void CreateNewKeyFrame();
 
+    // Offline mode: block until Local Mapping and Loop Closing are idle
+    void WaitForMappingIdle();
+
     // In case of performing only localization, this flag is true when there are no matches to
     // points in the map. Still tracking will continue if there are enough matches with temporal points.
     // In that case we are doing visual odometry. The system will try to do relocalization to recover
@@ -28,6 +28,7 @@
 #include "System.h"
 
 #include <mutex>
+#include <condition_variable>
 
 namespace ORB_SLAM2
 {
@@ -56,6 +57,10 @@ public:
 
     void Release();
 
+    // Block until the viewer has effectively stopped or finished
+    void WaitUntilStopped();
+    void WaitUntilFinished();
+
 private:
 
     bool Stop();
@@ -81,6 +86,11 @@ private:
     bool mbStopRequested;
     std::mutex mMutexStop;
 
+    // Notified, once the state mutexes are released, when the viewer stops, is released or finishes
+    void WakeUp();
+    std::mutex mMutexWakeUp;
+    std::condition_variable mcvWakeUp;
+
 };
 
 }
@@ -21,12 +21,13 @@
 #include "Frame.h"
 #include "Converter.h"
 #include "ORBmatcher.h"
+#include "Stats.h"
 #include <thread>
 
 namespace ORB_SLAM2
 {
 
-long unsigned int Frame::nNextId=0;
+std::atomic<long unsigned int> Frame::nNextId(0);
 bool Frame::mbInitialComputations=true;
 float Frame::cx, Frame::cy, Frame::fx, Frame::fy, Frame::invfx, Frame::invfy;
 float Frame::mnMinX, Frame::mnMinY, Frame::mnMaxX, Frame::mnMaxY;
@@ -57,6 +58,47 @@ Frame::Frame(const Frame &frame)
         SetPose(frame.mTcw);
 }
 
+void Frame::Swap(Frame &frame)
+{
+    std::swap(mpORBvocabulary,frame.mpORBvocabulary);
+    std::swap(mpORBextractorLeft,frame.mpORBextractorLeft);
+    std::swap(mpORBextractorRight,frame.mpORBextractorRight);
+    std::swap(mTimeStamp,frame.mTimeStamp);
+    std::swap(mK,frame.mK);
+    std::swap(mDistCoef,frame.mDistCoef);
+    std::swap(mbf,frame.mbf);
+    std::swap(mb,frame.mb);
+    std::swap(mThDepth,frame.mThDepth);
+    std::swap(N,frame.N);
+    mvKeys.swap(frame.mvKeys);
+    mvKeysRight.swap(frame.mvKeysRight);
+    mvKeysUn.swap(frame.mvKeysUn);
+    mvuRight.swap(frame.mvuRight);
+    mvDepth.swap(frame.mvDepth);
+    std::swap(mBowVec,frame.mBowVec);
+    std::swap(mFeatVec,frame.mFeatVec);
+    std::swap(mDescriptors,frame.mDescriptors);
+    std::swap(mDescriptorsRight,frame.mDescriptorsRight);
+    mvpMapPoints.swap(frame.mvpMapPoints);
+    mvbOutlier.swap(frame.mvbOutlier);
+    for(int i=0;i<FRAME_GRID_COLS;i++)
+        for(int j=0; j<FRAME_GRID_ROWS; j++)
+            mGrid[i][j].swap(frame.mGrid[i][j]);
+    std::swap(mTcw,frame.mTcw);
+    std::swap(mnId,frame.mnId);
+    std::swap(mpReferenceKF,frame.mpReferenceKF);
+    std::swap(mnScaleLevels,frame.mnScaleLevels);
+    std::swap(mfScaleFactor,frame.mfScaleFactor);
+    std::swap(mfLogScaleFactor,frame.mfLogScaleFactor);
+    mvScaleFactors.swap(frame.mvScaleFactors);
+    mvInvScaleFactors.swap(frame.mvInvScaleFactors);
+    mvLevelSigma2.swap(frame.mvLevelSigma2);
+    mvInvLevelSigma2.swap(frame.mvInvLevelSigma2);
+    std::swap(mRcw,frame.mRcw);
+    std::swap(mtcw,frame.mtcw);
+    std::swap(mRwc,frame.mRwc);
+    std::swap(mOw,frame.mOw);
+}
 
 Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
     :mpORBvocabulary(voc),mpORBextractorLeft(extractorLeft),mpORBextractorRight(extractorRight), mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
@@ -246,6 +288,8 @@ void Frame::AssignFeaturesToGrid()
 
 void Frame::ExtractORB(int flag, const cv::Mat &im)
 {
+    ScopedTimer timer(Stats::ORB_EXTRACTION);
+
     if(flag==0)
         (*mpORBextractorLeft)(im,cv::Mat(),mvKeys,mDescriptors);
     else
@@ -324,6 +368,91 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
     return true;
 }
 
+int Frame::isInFrustum(const vector<MapPoint*> &vpMPs, float viewingCosLimit, vector<bool> &vbInFrustum)
+{
+    const size_t N = vpMPs.size();
+    vbInFrustum.assign(N,false);
+
+    // Gather the geometry of the points in contiguous arrays, one lock per point
+    vector<float> vX(N), vY(N), vZ(N), vNx(N), vNy(N), vNz(N), vMinDist(N), vMaxDist(N);
+    for(size_t i=0; i<N; i++)
+    {
+        float pos[3], normal[3];
+        vpMPs[i]->GetGeometry(pos,normal,vMinDist[i],vMaxDist[i]);
+        vX[i]=pos[0]; vY[i]=pos[1]; vZ[i]=pos[2];
+        vNx[i]=normal[0]; vNy[i]=normal[1]; vNz[i]=normal[2];
+        vpMPs[i]->mbTrackInView = false;
+    }
+
+    float Rcw[3][3], tcw[3], Ow[3];
+    for(int r=0; r<3; r++)
+    {
+        for(int c=0; c<3; c++)
+            Rcw[r][c] = mRcw.at<float>(r,c);
+        tcw[r] = mtcw.at<float>(r);
+        Ow[r] = mOw.at<float>(r);
+    }
+
+    int nInFrustum = 0;
+    for(size_t i=0; i<N; i++)
+    {
+        // 3D in camera coordinates
+        const float PcX = Rcw[0][0]*vX[i]+Rcw[0][1]*vY[i]+Rcw[0][2]*vZ[i]+tcw[0];
+        const float PcY = Rcw[1][0]*vX[i]+Rcw[1][1]*vY[i]+Rcw[1][2]*vZ[i]+tcw[1];
+        const float PcZ = Rcw[2][0]*vX[i]+Rcw[2][1]*vY[i]+Rcw[2][2]*vZ[i]+tcw[2];
+
+        // Check positive depth
+        if(PcZ<0.0f)
+            continue;
+
+        // Project in image and check it is not outside
+        const float invz = 1.0f/PcZ;
+        const float u=fx*PcX*invz+cx;
+        const float v=fy*PcY*invz+cy;
+
+        if(u<mnMinX || u>mnMaxX)
+            continue;
+        if(v<mnMinY || v>mnMaxY)
+            continue;
+
+        // Check distance is in the scale invariance region of the MapPoint
+        const float POx = vX[i]-Ow[0];
+        const float POy = vY[i]-Ow[1];
+        const float POz = vZ[i]-Ow[2];
+        const float dist = sqrt(POx*POx+POy*POy+POz*POz);
+
+        if(dist<0.8f*vMinDist[i] || dist>1.2f*vMaxDist[i])
+            continue;
+
+        // Check viewing angle
+        const float viewCos = (POx*vNx[i]+POy*vNy[i]+POz*vNz[i])/dist;
+
+        if(viewCos<viewingCosLimit)
+            continue;
+
+        // Predict scale in the image
+        int nPredictedLevel = ceil(log(vMaxDist[i]/dist)/mfLogScaleFactor);
+        if(nPredictedLevel<0)
+            nPredictedLevel = 0;
+        else if(nPredictedLevel>=mnScaleLevels)
+            nPredictedLevel = mnScaleLevels-1;
+
+        // Data used by the tracking
+        MapPoint* pMP = vpMPs[i];
+        pMP->mbTrackInView = true;
+        pMP->mTrackProjX = u;
+        pMP->mTrackProjXR = u - mbf*invz;
+        pMP->mTrackProjY = v;
+        pMP->mnTrackScaleLevel= nPredictedLevel;
+        pMP->mTrackViewCos = viewCos;
+
+        vbInFrustum[i] = true;
+        nInFrustum++;
+    }
+
+    return nInFrustum;
+}
+
 vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const float  &r, const int minLevel, const int maxLevel) const
 {
     vector<size_t> vIndices;
@@ -396,8 +525,7 @@ void Frame::ComputeBoW()
 {
     if(mBowVec.empty())
     {
-        vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
-        mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,4);
+        mpORBvocabulary->transformRows(mDescriptors,mBowVec,mFeatVec,4);
     }
 }
 
@@ -465,6 +593,8 @@ void Frame::ComputeImageBounds(const cv::Mat &imLeft)
 
 void Frame::ComputeStereoMatches()
 {
+    ScopedTimer timer(Stats::STEREO_MATCHING);
+
     mvuRight = vector<float>(N,-1.0f);
     mvDepth = vector<float>(N,-1.0f);
 
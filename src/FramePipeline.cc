@@ -0,0 +1,149 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "FramePipeline.h"
+#include "System.h"
+
+namespace ORB_SLAM2
+{
+
+FramePipeline::FramePipeline(System *pSys, Tracking *pTracker, const int sensor):
+    mpSystem(pSys), mpTracker(pTracker), mSensor(sensor), mnMaxInput(2), mnMaxExtracted(1),
+    mnFrameIdRestarts(0), mbFinishRequested(false), mbExtractionFinished(false), mbTrackingFinished(false)
+{
+}
+
+std::future<cv::Mat> FramePipeline::Submit(const cv::Mat &imA, const cv::Mat &imB, const double &timestamp)
+{
+    InputJob job;
+    job.imA = imA;
+    job.imB = imB;
+    job.timestamp = timestamp;
+    std::future<cv::Mat> pose = job.pose.get_future();
+
+    unique_lock<mutex> lock(mMutexQueue);
+    mCondInput.wait(lock, [this]{ return mlInput.size()<mnMaxInput; });
+    mlInput.push_back(std::move(job));
+    mCondInput.notify_all();
+
+    return pose;
+}
+
+void FramePipeline::RunExtraction()
+{
+    while(1)
+    {
+        InputJob job;
+        unsigned long nFrameIdRestarts;
+        {
+            unique_lock<mutex> lock(mMutexQueue);
+            mCondInput.wait(lock, [this]{ return !mlInput.empty() || mbFinishRequested; });
+            if(mlInput.empty())
+                break;
+            job = std::move(mlInput.front());
+            mlInput.pop_front();
+            nFrameIdRestarts = mnFrameIdRestarts;
+            mCondInput.notify_all();
+        }
+
+        // Jobs are built in a one-element list and spliced into the queue. Frame has no move
+        // operations and is expensive to copy: it is swapped into the job, and later into Tracking.
+        std::list<ExtractedJob> lExtracted(1);
+        ExtractedJob &extracted = lExtracted.front();
+        if(mSensor==System::STEREO)
+        {
+            Frame frame = mpTracker->ExtractStereo(job.imA,job.imB,job.timestamp,extracted.imGray);
+            extracted.frame.Swap(frame);
+        }
+        else if(mSensor==System::RGBD)
+        {
+            Frame frame = mpTracker->ExtractRGBD(job.imA,job.imB,job.timestamp,extracted.imGray);
+            extracted.frame.Swap(frame);
+        }
+        else
+        {
+            Frame frame = mpTracker->ExtractMonocular(job.imA,job.timestamp,extracted.imGray);
+            extracted.frame.Swap(frame);
+        }
+        extracted.pose = std::move(job.pose);
+
+        unique_lock<mutex> lock(mMutexQueue);
+        mCondExtracted.wait(lock, [this]{ return mlExtracted.size()<mnMaxExtracted; });
+        // The id may have been taken before the restart, take a new one after the queued frames
+        if(nFrameIdRestarts!=mnFrameIdRestarts)
+            extracted.frame.mnId = Frame::nNextId++;
+        mlExtracted.splice(mlExtracted.end(),lExtracted);
+        mCondExtracted.notify_all();
+    }
+
+    unique_lock<mutex> lock(mMutexQueue);
+    mbExtractionFinished = true;
+    mCondExtracted.notify_all();
+}
+
+void FramePipeline::RunTracking()
+{
+    while(1)
+    {
+        std::list<ExtractedJob> lJob;
+        {
+            unique_lock<mutex> lock(mMutexQueue);
+            mCondExtracted.wait(lock, [this]{ return !mlExtracted.empty() || mbExtractionFinished; });
+            if(mlExtracted.empty())
+                break;
+            // Take the job out of the queue so that the next frame can be extracted meanwhile
+            lJob.splice(lJob.begin(),mlExtracted,mlExtracted.begin());
+            mCondExtracted.notify_all();
+        }
+
+        ExtractedJob &job = lJob.front();
+        cv::Mat Tcw = mpSystem->TrackExtractedFrame(job.frame,job.imGray);
+        job.pose.set_value(Tcw);
+    }
+
+    unique_lock<mutex> lock(mMutexQueue);
+    mbTrackingFinished = true;
+}
+
+void FramePipeline::RequestFinish()
+{
+    unique_lock<mutex> lock(mMutexQueue);
+    mbFinishRequested = true;
+    mCondInput.notify_all();
+}
+
+void FramePipeline::RestartFrameIds(Frame &frame)
+{
+    unique_lock<mutex> lock(mMutexQueue);
+    Frame::nNextId = 0;
+    frame.mnId = Frame::nNextId++;
+    for(std::list<ExtractedJob>::iterator lit=mlExtracted.begin(), lend=mlExtracted.end(); lit!=lend; lit++)
+        lit->frame.mnId = Frame::nNextId++;
+    mnFrameIdRestarts++;
+}
+
+bool FramePipeline::isFinished()
+{
+    unique_lock<mutex> lock(mMutexQueue);
+    return mbExtractionFinished && mbTrackingFinished;
+}
+
+} //namespace ORB_SLAM
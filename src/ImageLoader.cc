@@ -0,0 +1,96 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImageLoader.h"
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include <algorithm>
+
+namespace ORB_SLAM2
+{
+
+ImageLoader::ImageLoader(const std::vector<std::string> &vstrImages, const std::vector<std::string> &vstrImagesRight,
+                         const int nThreads, const int nMaxAhead, const int flags):
+    mvstrImages(vstrImages), mvstrImagesRight(vstrImagesRight), mFlags(flags), mnMaxAhead(std::max(nMaxAhead,1)),
+    mnNextToLoad(0), mnNextToGet(0), mbFinishRequested(false)
+{
+    const int nLoaders = std::max(nThreads,1);
+    mvThreads.reserve(nLoaders);
+    for(int i=0; i<nLoaders; i++)
+        mvThreads.push_back(std::thread(&ImageLoader::Run,this));
+}
+
+ImageLoader::~ImageLoader()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mbFinishRequested = true;
+    }
+    mCondSpace.notify_all();
+
+    for(size_t i=0; i<mvThreads.size(); i++)
+        mvThreads[i].join();
+}
+
+bool ImageLoader::GetImages(const size_t idx, cv::Mat &im, cv::Mat &imRight)
+{
+    if(idx>=mvstrImages.size())
+        return false;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondLoaded.wait(lock, [&]{ return mmLoaded.count(idx)>0; });
+
+    std::map<size_t, std::pair<cv::Mat,cv::Mat> >::iterator mit = mmLoaded.find(idx);
+    im = mit->second.first;
+    imRight = mit->second.second;
+    mmLoaded.erase(mit);
+
+    mnNextToGet = idx+1;
+    mCondSpace.notify_all();
+
+    return true;
+}
+
+void ImageLoader::Run()
+{
+    while(1)
+    {
+        size_t idx;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondSpace.wait(lock, [this]{ return mbFinishRequested || mnNextToLoad<mnNextToGet+mnMaxAhead; });
+            if(mbFinishRequested || mnNextToLoad>=mvstrImages.size())
+                break;
+            idx = mnNextToLoad++;
+        }
+
+        cv::Mat im = cv::imread(mvstrImages[idx],mFlags);
+        cv::Mat imRight;
+        if(!mvstrImagesRight.empty())
+            imRight = cv::imread(mvstrImagesRight[idx],mFlags);
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mmLoaded[idx] = std::make_pair(im,imRight);
+        mCondLoaded.notify_all();
+    }
+}
+
+} //namespace ORB_SLAM
@@ -22,19 +22,22 @@
 #include "Converter.h"
 #include "ORBmatcher.h"
 #include<mutex>
+#include<sstream>
 
 namespace ORB_SLAM2
 {
 
 long unsigned int KeyFrame::nNextId=0;
+atomic<long unsigned int> KeyFrame::nPayloadClock(0);
 
 KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
     mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
     mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
-    mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0),
+    mnBAGlobalForKF(0),
     fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
-    mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
+    mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mDistCoef.at<float>(0)==0.0 ? vector<cv::KeyPoint>() : F.mvKeys),
+    mvKeysUn(F.mvKeysUn),
     mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors.clone()),
     mBowVec(F.mBowVec), mFeatVec(F.mFeatVec), mnScaleLevels(F.mnScaleLevels), mfScaleFactor(F.mfScaleFactor),
     mfLogScaleFactor(F.mfLogScaleFactor), mvScaleFactors(F.mvScaleFactors), mvLevelSigma2(F.mvLevelSigma2),
@@ -45,26 +48,156 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
 {
     mnId=nNextId++;
 
-    mGrid.resize(mnGridCols);
+    mvGridCellStarts.resize(mnGridCols*mnGridRows+1);
+    mvGridIndices.reserve(N);
     for(int i=0; i<mnGridCols;i++)
     {
-        mGrid[i].resize(mnGridRows);
         for(int j=0; j<mnGridRows; j++)
-            mGrid[i][j] = F.mGrid[i][j];
+        {
+            mvGridCellStarts[i*mnGridRows+j] = mvGridIndices.size();
+            mvGridIndices.insert(mvGridIndices.end(),F.mGrid[i][j].begin(),F.mGrid[i][j].end());
+        }
     }
+    mvGridCellStarts.back() = mvGridIndices.size();
 
     SetPose(F.mTcw);    
+
+    mpCovisibility = make_shared<CovisibilityList>();
+
+    mbPayloadSpilled = false;
+    mpPayloadTiles = NULL;
+    mnPayloadPins = 0;
+    mnLastPayloadAccess = nPayloadClock++;
 }
 
 void KeyFrame::ComputeBoW()
 {
+    KeyFramePayloadPin pin(this);
     if(mBowVec.empty() || mFeatVec.empty())
     {
-        vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
         // Feature vector associate features with nodes in the 4th level (from leaves up)
         // We assume the vocabulary tree has 6 levels, change the 4 otherwise
-        mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,4);
+        mpORBvocabulary->transformRows(mDescriptors,mBowVec,mFeatVec,4);
+    }
+}
+
+void KeyFrame::PinPayload()
+{
+    unique_lock<mutex> lock(mMutexPayload);
+    if(mbPayloadSpilled)
+        LoadPayload();
+    mnPayloadPins++;
+    mnLastPayloadAccess = nPayloadClock++;
+}
+
+void KeyFrame::UnpinPayload()
+{
+    unique_lock<mutex> lock(mMutexPayload);
+    mnPayloadPins--;
+}
+
+bool KeyFrame::isPayloadSpilled()
+{
+    unique_lock<mutex> lock(mMutexPayload);
+    return mbPayloadSpilled;
+}
+
+long unsigned int KeyFrame::GetLastPayloadAccess()
+{
+    unique_lock<mutex> lock(mMutexPayload);
+    return mnLastPayloadAccess;
+}
+
+bool KeyFrame::SpillPayload(MapTiles* pTiles)
+{
+    unique_lock<mutex> lock(mMutexPayload);
+    if(mbPayloadSpilled || mnPayloadPins>0 || mFeatVec.empty())
+        return false;
+
+    // The data never changes once the BoW is computed, it is only written the first time.
+    // It is stored in the tile of the keyframe position at that time.
+    if(!mpPayloadTiles)
+    {
+        ostringstream f(ios::binary);
+
+        const int rows = mDescriptors.rows, cols = mDescriptors.cols, type = mDescriptors.type();
+        f.write((const char*)&rows,sizeof(rows));
+        f.write((const char*)&cols,sizeof(cols));
+        f.write((const char*)&type,sizeof(type));
+        for(int i=0; i<rows; i++)
+            f.write((const char*)mDescriptors.ptr(i),cols*mDescriptors.elemSize());
+
+        f.write((const char*)mvGridCellStarts.data(),mvGridCellStarts.size()*sizeof(unsigned int));
+        f.write((const char*)mvGridIndices.data(),mvGridIndices.size()*sizeof(unsigned int));
+
+        const size_t nNodes = mFeatVec.size();
+        f.write((const char*)&nNodes,sizeof(nNodes));
+        for(DBoW2::FeatureVector::const_iterator it=mFeatVec.begin(), itend=mFeatVec.end(); it!=itend; it++)
+        {
+            const size_t n = it->second.size();
+            f.write((const char*)&it->first,sizeof(it->first));
+            f.write((const char*)&n,sizeof(n));
+            f.write((const char*)it->second.data(),n*sizeof(unsigned int));
+        }
+
+        if(!pTiles->Write(GetCameraCenter(),f.str(),mPayloadRecord))
+            return false;
+
+        mpPayloadTiles = pTiles;
+    }
+
+    mDescriptors.release();
+    vector<unsigned int>().swap(mvGridCellStarts);
+    vector<unsigned int>().swap(mvGridIndices);
+    DBoW2::FeatureVector().swap(mFeatVec);
+    mbPayloadSpilled = true;
+
+    return true;
+}
+
+void KeyFrame::LoadPayload()
+{
+    string data;
+    if(!mpPayloadTiles->Read(mPayloadRecord,data))
+    {
+        cerr << "Failed to read the data of keyframe " << mnId << endl;
+        exit(-1);
+    }
+    istringstream f(data, ios::binary);
+
+    int rows, cols, type;
+    f.read((char*)&rows,sizeof(rows));
+    f.read((char*)&cols,sizeof(cols));
+    f.read((char*)&type,sizeof(type));
+    mDescriptors.create(rows,cols,type);
+    for(int i=0; i<rows; i++)
+        f.read((char*)mDescriptors.ptr(i),cols*mDescriptors.elemSize());
+
+    mvGridCellStarts.resize(mnGridCols*mnGridRows+1);
+    f.read((char*)mvGridCellStarts.data(),mvGridCellStarts.size()*sizeof(unsigned int));
+    mvGridIndices.resize(mvGridCellStarts.back());
+    f.read((char*)mvGridIndices.data(),mvGridIndices.size()*sizeof(unsigned int));
+
+    size_t nNodes;
+    f.read((char*)&nNodes,sizeof(nNodes));
+    for(size_t k=0; k<nNodes; k++)
+    {
+        DBoW2::NodeId nodeId;
+        size_t n;
+        f.read((char*)&nodeId,sizeof(nodeId));
+        f.read((char*)&n,sizeof(n));
+        vector<unsigned int> &vFeatures = mFeatVec[nodeId];
+        vFeatures.resize(n);
+        f.read((char*)vFeatures.data(),n*sizeof(unsigned int));
     }
+
+    if(!f.good())
+    {
+        cerr << "Failed to read the data of keyframe " << mnId << endl;
+        exit(-1);
+    }
+
+    mbPayloadSpilled = false;
 }
 
 void KeyFrame::SetPose(const cv::Mat &Tcw_)
@@ -143,17 +276,30 @@ void KeyFrame::UpdateBestCovisibles()
     for(map<KeyFrame*,int>::iterator mit=mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
        vPairs.push_back(make_pair(mit->second,mit->first));
 
-    sort(vPairs.begin(),vPairs.end());
-    list<KeyFrame*> lKFs;
-    list<int> lWs;
+    sort(vPairs.begin(),vPairs.end(),greater<pair<int,KeyFrame*> >());
+
+    mvpOrderedConnectedKeyFrames.resize(vPairs.size());
+    mvOrderedWeights.resize(vPairs.size());
     for(size_t i=0, iend=vPairs.size(); i<iend;i++)
     {
-        lKFs.push_front(vPairs[i].second);
-        lWs.push_front(vPairs[i].first);
+        mvpOrderedConnectedKeyFrames[i] = vPairs[i].second;
+        mvOrderedWeights[i] = vPairs[i].first;
     }
 
-    mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
-    mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());    
+    PublishCovisibility();
+}
+
+void KeyFrame::PublishCovisibility()
+{
+    shared_ptr<CovisibilityList> pList = make_shared<CovisibilityList>();
+    pList->vpKeyFrames = mvpOrderedConnectedKeyFrames;
+    pList->vWeights = mvOrderedWeights;
+    atomic_store(&mpCovisibility,CovisibilityListPtr(pList));
+}
+
+CovisibilityListPtr KeyFrame::GetCovisibilityList()
+{
+    return atomic_load(&mpCovisibility);
 }
 
 set<KeyFrame*> KeyFrame::GetConnectedKeyFrames()
@@ -167,34 +313,33 @@ set<KeyFrame*> KeyFrame::GetConnectedKeyFrames()
 
 vector<KeyFrame*> KeyFrame::GetVectorCovisibleKeyFrames()
 {
-    unique_lock<mutex> lock(mMutexConnections);
-    return mvpOrderedConnectedKeyFrames;
+    return GetCovisibilityList()->vpKeyFrames;
 }
 
 vector<KeyFrame*> KeyFrame::GetBestCovisibilityKeyFrames(const int &N)
 {
-    unique_lock<mutex> lock(mMutexConnections);
-    if((int)mvpOrderedConnectedKeyFrames.size()<N)
-        return mvpOrderedConnectedKeyFrames;
+    CovisibilityListPtr pList = GetCovisibilityList();
+    if((int)pList->vpKeyFrames.size()<N)
+        return pList->vpKeyFrames;
     else
-        return vector<KeyFrame*>(mvpOrderedConnectedKeyFrames.begin(),mvpOrderedConnectedKeyFrames.begin()+N);
+        return vector<KeyFrame*>(pList->vpKeyFrames.begin(),pList->vpKeyFrames.begin()+N);
 
 }
 
 vector<KeyFrame*> KeyFrame::GetCovisiblesByWeight(const int &w)
 {
-    unique_lock<mutex> lock(mMutexConnections);
+    CovisibilityListPtr pList = GetCovisibilityList();
 
-    if(mvpOrderedConnectedKeyFrames.empty())
+    if(pList->vpKeyFrames.empty())
         return vector<KeyFrame*>();
 
-    vector<int>::iterator it = upper_bound(mvOrderedWeights.begin(),mvOrderedWeights.end(),w,KeyFrame::weightComp);
-    if(it==mvOrderedWeights.end())
+    vector<int>::const_iterator it = upper_bound(pList->vWeights.begin(),pList->vWeights.end(),w,KeyFrame::weightComp);
+    if(it==pList->vWeights.end())
         return vector<KeyFrame*>();
     else
     {
-        int n = it-mvOrderedWeights.begin();
-        return vector<KeyFrame*>(mvpOrderedConnectedKeyFrames.begin(), mvpOrderedConnectedKeyFrames.begin()+n);
+        int n = it-pList->vWeights.begin();
+        return vector<KeyFrame*>(pList->vpKeyFrames.begin(), pList->vpKeyFrames.begin()+n);
     }
 }
 
@@ -298,7 +443,8 @@ void KeyFrame::UpdateConnections()
     }
 
     //For all map points in keyframe check in which other keyframes are they seen
-    //Increase counter for those keyframes
+    vector<KeyFrame*> vpObservingKFs;
+    vpObservingKFs.reserve(8*vpMP.size());
     for(vector<MapPoint*>::iterator vit=vpMP.begin(), vend=vpMP.end(); vit!=vend; vit++)
     {
         MapPoint* pMP = *vit;
@@ -309,14 +455,20 @@ void KeyFrame::UpdateConnections()
         if(pMP->isBad())
             continue;
 
-        map<KeyFrame*,size_t> observations = pMP->GetObservations();
+        pMP->GetObservingKeyFrames(vpObservingKFs);
+    }
 
-        for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-        {
-            if(mit->first->mnId==mnId)
-                continue;
-            KFcounter[mit->first]++;
-        }
+    //Increase counter for those keyframes (one per observation)
+    sort(vpObservingKFs.begin(),vpObservingKFs.end());
+    for(size_t i=0, iend=vpObservingKFs.size(); i<iend;)
+    {
+        KeyFrame* pKFi = vpObservingKFs[i];
+        size_t j=i+1;
+        while(j<iend && vpObservingKFs[j]==pKFi)
+            j++;
+        if(pKFi->mnId!=mnId)
+            KFcounter.insert(KFcounter.end(),make_pair(pKFi,(int)(j-i)));
+        i=j;
     }
 
     // This should not happen
@@ -351,22 +503,21 @@ void KeyFrame::UpdateConnections()
         pKFmax->AddConnection(this,nmax);
     }
 
-    sort(vPairs.begin(),vPairs.end());
-    list<KeyFrame*> lKFs;
-    list<int> lWs;
-    for(size_t i=0; i<vPairs.size();i++)
-    {
-        lKFs.push_front(vPairs[i].second);
-        lWs.push_front(vPairs[i].first);
-    }
+    sort(vPairs.begin(),vPairs.end(),greater<pair<int,KeyFrame*> >());
 
     {
         unique_lock<mutex> lockCon(mMutexConnections);
 
         // mspConnectedKeyFrames = spConnectedKeyFrames;
-        mConnectedKeyFrameWeights = KFcounter;
-        mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
-        mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
+        mConnectedKeyFrameWeights.swap(KFcounter);
+        mvpOrderedConnectedKeyFrames.resize(vPairs.size());
+        mvOrderedWeights.resize(vPairs.size());
+        for(size_t i=0; i<vPairs.size();i++)
+        {
+            mvpOrderedConnectedKeyFrames[i] = vPairs[i].second;
+            mvOrderedWeights[i] = vPairs[i].first;
+        }
+        PublishCovisibility();
 
         if(mbFirstConnection && mnId!=0)
         {
@@ -475,6 +626,8 @@ void KeyFrame::SetBadFlag()
 
         mConnectedKeyFrameWeights.clear();
         mvpOrderedConnectedKeyFrames.clear();
+        mvOrderedWeights.clear();
+        PublishCovisibility();
 
         // Update Spanning Tree
         set<KeyFrame*> sParentCandidates;
@@ -591,15 +744,15 @@ vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const
     {
         for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
         {
-            const vector<size_t> vCell = mGrid[ix][iy];
-            for(size_t j=0, jend=vCell.size(); j<jend; j++)
+            const int c = ix*mnGridRows+iy;
+            for(unsigned int j=mvGridCellStarts[c], jend=mvGridCellStarts[c+1]; j<jend; j++)
             {
-                const cv::KeyPoint &kpUn = mvKeysUn[vCell[j]];
+                const cv::KeyPoint &kpUn = mvKeysUn[mvGridIndices[j]];
                 const float distx = kpUn.pt.x-x;
                 const float disty = kpUn.pt.y-y;
 
                 if(fabs(distx)<r && fabs(disty)<r)
-                    vIndices.push_back(vCell[j]);
+                    vIndices.push_back(mvGridIndices[j]);
             }
         }
     }
@@ -617,8 +770,9 @@ cv::Mat KeyFrame::UnprojectStereo(int i)
     const float z = mvDepth[i];
     if(z>0)
     {
-        const float u = mvKeys[i].pt.x;
-        const float v = mvKeys[i].pt.y;
+        const cv::KeyPoint &kp = mvKeys.empty() ? mvKeysUn[i] : mvKeys[i];
+        const float u = kp.pt.x;
+        const float v = kp.pt.y;
         const float x = (u-cx)*z*invfx;
         const float y = (v-cy)*z*invfy;
         cv::Mat x3Dc = (cv::Mat_<float>(3,1) << x, y, z);
@@ -24,118 +24,243 @@
 #include "Thirdparty/DBoW2/DBoW2/BowVector.h"
 
 #include<mutex>
+#include<algorithm>
+#include<functional>
 
 using namespace std;
 
 namespace ORB_SLAM2
 {
 
+const int KeyFrameDatabase::MAX_SCORED_CANDIDATES = 100;
+
 KeyFrameDatabase::KeyFrameDatabase (const ORBVocabulary &voc):
-    mpVoc(&voc)
+    mpVoc(&voc), mbL1Scoring(voc.getScoringType()==DBoW2::L1_NORM)
 {
     mvInvertedFile.resize(voc.size());
+    mvnTombstones.resize(voc.size(),0);
 }
 
 
 void KeyFrameDatabase::add(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutex);
+    unique_lock<ReadWriteMutex> lock(mMutex);
+
+    const unsigned int id = pKF->mnId;
+    if(id>=mvpKeyFrames.size())
+        mvpKeyFrames.resize(id+1,static_cast<KeyFrame*>(NULL));
+    else if(mvpKeyFrames[id])
+        return;
+
+    mvpKeyFrames[id] = pKF;
 
     for(DBoW2::BowVector::const_iterator vit= pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
-        mvInvertedFile[vit->first].push_back(pKF);
+    {
+        Posting posting;
+        posting.id = id;
+        posting.weight = vit->second;
+        mvInvertedFile[vit->first].push_back(posting);
+    }
 }
 
 void KeyFrameDatabase::erase(KeyFrame* pKF)
 {
-    unique_lock<mutex> lock(mMutex);
+    unique_lock<ReadWriteMutex> lock(mMutex);
+
+    const unsigned int id = pKF->mnId;
+    if(id>=mvpKeyFrames.size() || mvpKeyFrames[id]!=pKF)
+        return;
+
+    // The entries of the keyframe become tombstones
+    mvpKeyFrames[id] = static_cast<KeyFrame*>(NULL);
 
-    // Erase elements in the Inverse File for the entry
     for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
     {
-        // List of keyframes that share the word
-        list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+        vector<Posting> &vPostings = mvInvertedFile[vit->first];
+        int &nTombstones = mvnTombstones[vit->first];
+        nTombstones++;
 
-        for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+        // Compact the list once half of it is dead
+        if(2*nTombstones>(int)vPostings.size())
         {
-            if(pKF==*lit)
+            size_t j=0;
+            for(size_t i=0, iend=vPostings.size(); i<iend; i++)
             {
-                lKFs.erase(lit);
-                break;
+                if(mvpKeyFrames[vPostings[i].id])
+                    vPostings[j++] = vPostings[i];
             }
+            vPostings.resize(j);
+            nTombstones = 0;
         }
     }
 }
 
 void KeyFrameDatabase::clear()
 {
+    unique_lock<ReadWriteMutex> lock(mMutex);
+
     mvInvertedFile.clear();
     mvInvertedFile.resize(mpVoc->size());
+    mvnTombstones.assign(mpVoc->size(),0);
+    mvpKeyFrames.clear();
 }
 
-
-vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore)
+void KeyFrameDatabase::ScanInvertedFile(const DBoW2::BowVector &BowVec, const vector<bool> &vbExcluded,
+                                        vector<int> &vnCommonWords, vector<float> &vScores,
+                                        vector<KeyFrame*> &vpKFsSharingWords)
 {
-    set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-    list<KeyFrame*> lKFsSharingWords;
+    // Query words by decreasing weight
+    vector<pair<float,DBoW2::WordId> > vQueryWords;
+    vQueryWords.reserve(BowVec.size());
+    float remainingWeight = 0;
+    for(DBoW2::BowVector::const_iterator vit=BowVec.begin(), vend=BowVec.end(); vit != vend; vit++)
+    {
+        vQueryWords.push_back(make_pair((float)vit->second,vit->first));
+        remainingWeight += vit->second;
+    }
+    sort(vQueryWords.begin(),vQueryWords.end(),greater<pair<float,DBoW2::WordId> >());
 
-    // Search all keyframes that share a word with current keyframes
-    // Discard keyframes connected to the query keyframe
+    ReadLock lock(mMutex);
+
+    vnCommonWords.assign(mvpKeyFrames.size(),0);
+    vScores.assign(mvpKeyFrames.size(),0.0f);
+    vpKFsSharingWords.clear();
+
+    bool bAdmit = true;
+    vector<float> vPartialScores;
+
+    for(size_t i=0, iend=vQueryWords.size(); i<iend; i++)
     {
-        unique_lock<mutex> lock(mMutex);
+        const float queryWeight = vQueryWords[i].first;
+        const vector<Posting> &vPostings = mvInvertedFile[vQueryWords[i].second];
 
-        for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
+        for(vector<Posting>::const_iterator pit=vPostings.begin(), pend=vPostings.end(); pit!=pend; pit++)
         {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+            const unsigned int id = pit->id;
+            KeyFrame* pKFi = mvpKeyFrames[id];
+            if(!pKFi || (id<vbExcluded.size() && vbExcluded[id]))
+                continue;
 
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+            if(vnCommonWords[id]==0)
             {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnLoopQuery!=pKF->mnId)
-                {
-                    pKFi->mnLoopWords=0;
-                    if(!spConnectedKeyFrames.count(pKFi))
-                    {
-                        pKFi->mnLoopQuery=pKF->mnId;
-                        lKFsSharingWords.push_back(pKFi);
-                    }
-                }
-                pKFi->mnLoopWords++;
+                if(!bAdmit)
+                    continue;
+                vpKFsSharingWords.push_back(pKFi);
             }
+
+            vnCommonWords[id]++;
+            vScores[id] += min(queryWeight,pit->weight);
+        }
+
+        remainingWeight -= queryWeight;
+
+        // The L1 score of two normalized vectors is the sum over common words of the smallest
+        // weight, so a keyframe not seen yet scores at most the query weight left. Every few
+        // words check whether it could still get among the best partial scores
+        if(mbL1Scoring && bAdmit && i%8==7 && (int)vpKFsSharingWords.size()>MAX_SCORED_CANDIDATES)
+        {
+            vPartialScores.resize(vpKFsSharingWords.size());
+            for(size_t j=0, jend=vpKFsSharingWords.size(); j<jend; j++)
+                vPartialScores[j] = vScores[vpKFsSharingWords[j]->mnId];
+
+            nth_element(vPartialScores.begin(),vPartialScores.begin()+MAX_SCORED_CANDIDATES-1,
+                        vPartialScores.end(),greater<float>());
+            if(remainingWeight<vPartialScores[MAX_SCORED_CANDIDATES-1])
+                bAdmit = false;
         }
     }
+}
 
-    if(lKFsSharingWords.empty())
-        return vector<KeyFrame*>();
+void KeyFrameDatabase::KeepBestScores(vector<pair<float,KeyFrame*> > &vScoreAndMatch)
+{
+    if((int)vScoreAndMatch.size()<=MAX_SCORED_CANDIDATES)
+        return;
 
-    list<pair<float,KeyFrame*> > lScoreAndMatch;
+    vector<float> vScores;
+    vScores.reserve(vScoreAndMatch.size());
+    for(size_t i=0, iend=vScoreAndMatch.size(); i<iend; i++)
+        vScores.push_back(vScoreAndMatch[i].first);
+
+    nth_element(vScores.begin(),vScores.begin()+MAX_SCORED_CANDIDATES-1,vScores.end(),greater<float>());
+    const float th = vScores[MAX_SCORED_CANDIDATES-1];
+
+    int nTies = MAX_SCORED_CANDIDATES;
+    for(size_t i=0, iend=vScores.size(); i<iend; i++)
+    {
+        if(vScores[i]>th)
+            nTies--;
+    }
+
+    // Keep the order in which the keyframes were found
+    size_t j=0;
+    for(size_t i=0, iend=vScoreAndMatch.size(); i<iend; i++)
+    {
+        const float si = vScoreAndMatch[i].first;
+        if(si>th || (si==th && nTies-->0))
+            vScoreAndMatch[j++] = vScoreAndMatch[i];
+    }
+    vScoreAndMatch.resize(j);
+}
+
+
+vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore)
+{
+    set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
+
+    // Discard keyframes connected to the query keyframe
+    vector<bool> vbConnected;
+    for(set<KeyFrame*>::iterator sit=spConnectedKeyFrames.begin(), send=spConnectedKeyFrames.end(); sit!=send; sit++)
+    {
+        const unsigned int id = (*sit)->mnId;
+        if(id>=vbConnected.size())
+            vbConnected.resize(id+1,false);
+        vbConnected[id] = true;
+    }
+
+    // Search all keyframes that share a word with current keyframes
+    // The counters are local to this query, indexed by keyframe id
+    vector<int> vnLoopWords;
+    vector<float> vWordScores;
+    vector<KeyFrame*> vpKFsSharingWords;
+    ScanInvertedFile(pKF->mBowVec,vbConnected,vnLoopWords,vWordScores,vpKFsSharingWords);
+
+    if(vpKFsSharingWords.empty())
+        return vector<KeyFrame*>();
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator vit=vpKFsSharingWords.begin(), vend=vpKFsSharingWords.end(); vit!=vend; vit++)
     {
-        if((*lit)->mnLoopWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnLoopWords;
+        if(vnLoopWords[(*vit)->mnId]>maxCommonWords)
+            maxCommonWords=vnLoopWords[(*vit)->mnId];
     }
 
     int minCommonWords = maxCommonWords*0.8f;
 
-    int nscores=0;
-
-    // Compute similarity score. Retain the matches whose score is higher than minScore
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    // Compute similarity score
+    vector<pair<float,KeyFrame*> > vScoreAndMatch;
+    for(vector<KeyFrame*>::iterator vit=vpKFsSharingWords.begin(), vend=vpKFsSharingWords.end(); vit!=vend; vit++)
     {
-        KeyFrame* pKFi = *lit;
+        KeyFrame* pKFi = *vit;
 
-        if(pKFi->mnLoopWords>minCommonWords)
+        if(vnLoopWords[pKFi->mnId]>minCommonWords)
         {
-            nscores++;
+            float si = mbL1Scoring ? vWordScores[pKFi->mnId] : mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
+            vScoreAndMatch.push_back(make_pair(si,pKFi));
+        }
+    }
 
-            float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
+    KeepBestScores(vScoreAndMatch);
 
-            pKFi->mLoopScore = si;
-            if(si>=minScore)
-                lScoreAndMatch.push_back(make_pair(si,pKFi));
-        }
+    // Score of the compared keyframes (negative if not compared)
+    // Retain the matches whose score is higher than minScore
+    vector<float> vLoopScore(vnLoopWords.size(),-1.0f);
+    list<pair<float,KeyFrame*> > lScoreAndMatch;
+    for(vector<pair<float,KeyFrame*> >::iterator it=vScoreAndMatch.begin(), itend=vScoreAndMatch.end(); it!=itend; it++)
+    {
+        vLoopScore[it->second->mnId] = it->first;
+        if(it->first>=minScore)
+            lScoreAndMatch.push_back(*it);
     }
 
     if(lScoreAndMatch.empty())
@@ -148,21 +273,23 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
     for(list<pair<float,KeyFrame*> >::iterator it=lScoreAndMatch.begin(), itend=lScoreAndMatch.end(); it!=itend; it++)
     {
         KeyFrame* pKFi = it->second;
-        vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
+        const CovisibilityListPtr pNeighs = pKFi->GetCovisibilityList();
+        const size_t nNeighs = min<size_t>(pNeighs->vpKeyFrames.size(),10);
 
         float bestScore = it->first;
         float accScore = it->first;
         KeyFrame* pBestKF = pKFi;
-        for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
+        for(size_t iNeigh=0; iNeigh<nNeighs; iNeigh++)
         {
-            KeyFrame* pKF2 = *vit;
-            if(pKF2->mnLoopQuery==pKF->mnId && pKF2->mnLoopWords>minCommonWords)
+            KeyFrame* pKF2 = pNeighs->vpKeyFrames[iNeigh];
+            if(pKF2->mnId<vLoopScore.size() && vLoopScore[pKF2->mnId]>=0)
             {
-                accScore+=pKF2->mLoopScore;
-                if(pKF2->mLoopScore>bestScore)
+                const float score2 = vLoopScore[pKF2->mnId];
+                accScore+=score2;
+                if(score2>bestScore)
                 {
                     pBestKF=pKF2;
-                    bestScore = pKF2->mLoopScore;
+                    bestScore = score2;
                 }
             }
         }
@@ -198,86 +325,74 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
 
 vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
 {
-    list<KeyFrame*> lKFsSharingWords;
-
     // Search all keyframes that share a word with current frame
-    {
-        unique_lock<mutex> lock(mMutex);
-
-        for(DBoW2::BowVector::const_iterator vit=F->mBowVec.begin(), vend=F->mBowVec.end(); vit != vend; vit++)
-        {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+    // The counters are local to this query, indexed by keyframe id
+    vector<int> vnRelocWords;
+    vector<float> vWordScores;
+    vector<KeyFrame*> vpKFsSharingWords;
+    ScanInvertedFile(F->mBowVec,vector<bool>(),vnRelocWords,vWordScores,vpKFsSharingWords);
 
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
-            {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnRelocQuery!=F->mnId)
-                {
-                    pKFi->mnRelocWords=0;
-                    pKFi->mnRelocQuery=F->mnId;
-                    lKFsSharingWords.push_back(pKFi);
-                }
-                pKFi->mnRelocWords++;
-            }
-        }
-    }
-    if(lKFsSharingWords.empty())
+    if(vpKFsSharingWords.empty())
         return vector<KeyFrame*>();
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator vit=vpKFsSharingWords.begin(), vend=vpKFsSharingWords.end(); vit!=vend; vit++)
     {
-        if((*lit)->mnRelocWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnRelocWords;
+        if(vnRelocWords[(*vit)->mnId]>maxCommonWords)
+            maxCommonWords=vnRelocWords[(*vit)->mnId];
     }
 
     int minCommonWords = maxCommonWords*0.8f;
 
-    list<pair<float,KeyFrame*> > lScoreAndMatch;
-
-    int nscores=0;
-
     // Compute similarity score.
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    vector<pair<float,KeyFrame*> > vScoreAndMatch;
+    for(vector<KeyFrame*>::iterator vit=vpKFsSharingWords.begin(), vend=vpKFsSharingWords.end(); vit!=vend; vit++)
     {
-        KeyFrame* pKFi = *lit;
+        KeyFrame* pKFi = *vit;
 
-        if(pKFi->mnRelocWords>minCommonWords)
+        if(vnRelocWords[pKFi->mnId]>minCommonWords)
         {
-            nscores++;
-            float si = mpVoc->score(F->mBowVec,pKFi->mBowVec);
-            pKFi->mRelocScore=si;
-            lScoreAndMatch.push_back(make_pair(si,pKFi));
+            float si = mbL1Scoring ? vWordScores[pKFi->mnId] : mpVoc->score(F->mBowVec,pKFi->mBowVec);
+            vScoreAndMatch.push_back(make_pair(si,pKFi));
         }
     }
 
-    if(lScoreAndMatch.empty())
+    if(vScoreAndMatch.empty())
         return vector<KeyFrame*>();
 
+    KeepBestScores(vScoreAndMatch);
+
+    // Score of the compared keyframes (negative if not compared)
+    vector<float> vRelocScore(vnRelocWords.size(),-1.0f);
+    for(vector<pair<float,KeyFrame*> >::iterator it=vScoreAndMatch.begin(), itend=vScoreAndMatch.end(); it!=itend; it++)
+        vRelocScore[it->second->mnId] = it->first;
+
     list<pair<float,KeyFrame*> > lAccScoreAndMatch;
     float bestAccScore = 0;
 
     // Lets now accumulate score by covisibility
-    for(list<pair<float,KeyFrame*> >::iterator it=lScoreAndMatch.begin(), itend=lScoreAndMatch.end(); it!=itend; it++)
+    for(vector<pair<float,KeyFrame*> >::iterator it=vScoreAndMatch.begin(), itend=vScoreAndMatch.end(); it!=itend; it++)
     {
         KeyFrame* pKFi = it->second;
-        vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
+        const CovisibilityListPtr pNeighs = pKFi->GetCovisibilityList();
+        const size_t nNeighs = min<size_t>(pNeighs->vpKeyFrames.size(),10);
 
         float bestScore = it->first;
         float accScore = bestScore;
         KeyFrame* pBestKF = pKFi;
-        for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
+        for(size_t iNeigh=0; iNeigh<nNeighs; iNeigh++)
         {
-            KeyFrame* pKF2 = *vit;
-            if(pKF2->mnRelocQuery!=F->mnId)
+            KeyFrame* pKF2 = pNeighs->vpKeyFrames[iNeigh];
+            if(pKF2->mnId>=vRelocScore.size() || vRelocScore[pKF2->mnId]<0)
                 continue;
 
-            accScore+=pKF2->mRelocScore;
-            if(pKF2->mRelocScore>bestScore)
+            const float score2 = vRelocScore[pKF2->mnId];
+            accScore+=score2;
+            if(score2>bestScore)
             {
                 pBestKF=pKF2;
-                bestScore = pKF2->mRelocScore;
+                bestScore = score2;
             }
 
         }
@@ -22,15 +22,23 @@
 #include "LoopClosing.h"
 #include "ORBmatcher.h"
 #include "Optimizer.h"
-#include <unistd.h>
+#include "Stats.h"
+#include "Converter.h"
 
 #include<mutex>
+#include<thread>
+#include<functional>
+
+#include <Eigen/SVD>
 
 namespace ORB_SLAM2
 {
 
+const size_t LocalMapping::FUSE_BLOCK_SIZE = 256;
+
 LocalMapping::LocalMapping(Map *pMap, const float bMonocular):
     mbMonocular(bMonocular), mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
+    mnTriangulationEnd(0),
     mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true)
 {
 }
@@ -86,13 +94,17 @@ void LocalMapping::Run()
             }
 
             mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
+
+            // Move the matching data of the least recently used keyframes to disk if over budget
+            mpMap->EnforceKeyFrameBudget();
         }
         else if(Stop())
         {
             // Safe area to stop
-            while(isStopped() && !CheckFinish())
             {
-                usleep(3000);
+                unique_lock<mutex> lock(mMutexWakeUp);
+                while(isStopped() && !CheckFinish())
+                    mcvWakeUp.wait(lock);
             }
             if(CheckFinish())
                 break;
@@ -106,7 +118,19 @@ void LocalMapping::Run()
         if(CheckFinish())
             break;
 
-        usleep(3000);
+        // Sleep until a keyframe is inserted or a stop, reset or finish is requested
+        {
+            unique_lock<mutex> lock(mMutexWakeUp);
+            while(!CheckNewKeyFrames() && !CheckFinish() && !CheckResetRequested())
+            {
+                {
+                    unique_lock<mutex> lock2(mMutexStop);
+                    if(mbStopRequested && !mbNotStop)
+                        break;
+                }
+                mcvWakeUp.wait(lock);
+            }
+        }
     }
 
     SetFinish();
@@ -114,9 +138,19 @@ void LocalMapping::Run()
 
 void LocalMapping::InsertKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexNewKFs);
-    mlNewKeyFrames.push_back(pKF);
-    mbAbortBA=true;
+    {
+        unique_lock<mutex> lock(mMutexNewKFs);
+        mlNewKeyFrames.push_back(pKF);
+        mlNewKeyFrameTimes.push_back(chrono::steady_clock::now());
+        mbAbortBA=true;
+    }
+    WakeUp();
+}
+
+void LocalMapping::WakeUp()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    mcvWakeUp.notify_all();
 }
 
 
@@ -132,6 +166,9 @@ void LocalMapping::ProcessNewKeyFrame()
         unique_lock<mutex> lock(mMutexNewKFs);
         mpCurrentKeyFrame = mlNewKeyFrames.front();
         mlNewKeyFrames.pop_front();
+        Stats::Record(Stats::KEYFRAME_HANDOFF, chrono::duration_cast<chrono::duration<double,micro> >(
+                          chrono::steady_clock::now()-mlNewKeyFrameTimes.front()).count());
+        mlNewKeyFrameTimes.pop_front();
     }
 
     // Compute Bags of Words structures
@@ -211,244 +248,291 @@ void LocalMapping::CreateNewMapPoints()
     int nn = 10;
     if(mbMonocular)
         nn=20;
-    const vector<KeyFrame*> vpNeighKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(nn);
+    mvpTriangulationKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(nn);
 
-    ORBmatcher matcher(0.6,false);
+    const int nNeighbors = mvpTriangulationKFs.size();
+    mvvTriangulatedPoints.assign(nNeighbors,vector<TriangulatedPoint>());
+    mnTriangulationEnd = nNeighbors;
 
-    cv::Mat Rcw1 = mpCurrentKeyFrame->GetRotation();
-    cv::Mat Rwc1 = Rcw1.t();
-    cv::Mat tcw1 = mpCurrentKeyFrame->GetTranslation();
-    cv::Mat Tcw1(3,4,CV_32F);
-    Rcw1.copyTo(Tcw1.colRange(0,3));
-    tcw1.copyTo(Tcw1.col(3));
-    cv::Mat Ow1 = mpCurrentKeyFrame->GetCameraCenter();
-
-    const float &fx1 = mpCurrentKeyFrame->fx;
-    const float &fy1 = mpCurrentKeyFrame->fy;
-    const float &cx1 = mpCurrentKeyFrame->cx;
-    const float &cy1 = mpCurrentKeyFrame->cy;
-    const float &invfx1 = mpCurrentKeyFrame->invfx;
-    const float &invfy1 = mpCurrentKeyFrame->invfy;
+    // Search matches with epipolar restriction and triangulate, one neighbor per thread at a time.
+    // The map is not modified until all of them are done.
+    RunParallel(nNeighbors,[&](const int i)
+    {
+        TriangulateNeighbor(i);
+    });
 
-    const float ratioFactor = 1.5f*mpCurrentKeyFrame->mfScaleFactor;
+    // Create the new MapPoints in neighbor order. A keypoint of the current keyframe triangulated
+    // with several neighbors keeps the point of the first one, as if they had been processed in sequence.
+    const vector<MapPoint*> vpMapPoints1 = mpCurrentKeyFrame->GetMapPointMatches();
+    vector<bool> vbTriangulated1(vpMapPoints1.size(),false);
+    for(size_t i=0; i<vpMapPoints1.size(); i++)
+        vbTriangulated1[i] = vpMapPoints1[i]!=NULL;
 
     int nnew=0;
 
-    // Search matches with epipolar restriction and triangulate
-    for(size_t i=0; i<vpNeighKFs.size(); i++)
+    const int nEnd = mnTriangulationEnd;
+    for(int i=0; i<nEnd; i++)
     {
-        if(i>0 && CheckNewKeyFrames())
-            return;
+        KeyFrame* pKF2 = mvpTriangulationKFs[i];
+        const vector<TriangulatedPoint> &vTriangulated = mvvTriangulatedPoints[i];
 
-        KeyFrame* pKF2 = vpNeighKFs[i];
-
-        // Check first that baseline is not too short
-        cv::Mat Ow2 = pKF2->GetCameraCenter();
-        cv::Mat vBaseline = Ow2-Ow1;
-        const float baseline = cv::norm(vBaseline);
-
-        if(!mbMonocular)
-        {
-            if(baseline<pKF2->mb)
-            continue;
-        }
-        else
+        for(size_t j=0, jend=vTriangulated.size(); j<jend; j++)
         {
-            const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
-            const float ratioBaselineDepth = baseline/medianDepthKF2;
+            const int idx1 = vTriangulated[j].idx1;
+            const int idx2 = vTriangulated[j].idx2;
 
-            if(ratioBaselineDepth<0.01)
+            if(vbTriangulated1[idx1] || pKF2->GetMapPoint(idx2))
                 continue;
-        }
 
-        // Compute Fundamental Matrix
-        cv::Mat F12 = ComputeF12(mpCurrentKeyFrame,pKF2);
-
-        // Search matches that fullfil epipolar constraint
-        vector<pair<size_t,size_t> > vMatchedIndices;
-        matcher.SearchForTriangulation(mpCurrentKeyFrame,pKF2,F12,vMatchedIndices,false);
-
-        cv::Mat Rcw2 = pKF2->GetRotation();
-        cv::Mat Rwc2 = Rcw2.t();
-        cv::Mat tcw2 = pKF2->GetTranslation();
-        cv::Mat Tcw2(3,4,CV_32F);
-        Rcw2.copyTo(Tcw2.colRange(0,3));
-        tcw2.copyTo(Tcw2.col(3));
-
-        const float &fx2 = pKF2->fx;
-        const float &fy2 = pKF2->fy;
-        const float &cx2 = pKF2->cx;
-        const float &cy2 = pKF2->cy;
-        const float &invfx2 = pKF2->invfx;
-        const float &invfy2 = pKF2->invfy;
-
-        // Triangulate each match
-        const int nmatches = vMatchedIndices.size();
-        for(int ikp=0; ikp<nmatches; ikp++)
-        {
-            const int &idx1 = vMatchedIndices[ikp].first;
-            const int &idx2 = vMatchedIndices[ikp].second;
+            // Triangulation is succesfull
+            const cv::Mat x3D = Converter::toCvMat(Eigen::Matrix<double,3,1>(vTriangulated[j].x3D.cast<double>()));
+            MapPoint* pMP = new MapPoint(x3D,mpCurrentKeyFrame,mpMap);
 
-            const cv::KeyPoint &kp1 = mpCurrentKeyFrame->mvKeysUn[idx1];
-            const float kp1_ur=mpCurrentKeyFrame->mvuRight[idx1];
-            bool bStereo1 = kp1_ur>=0;
+            pMP->AddObservation(mpCurrentKeyFrame,idx1);            
+            pMP->AddObservation(pKF2,idx2);
 
-            const cv::KeyPoint &kp2 = pKF2->mvKeysUn[idx2];
-            const float kp2_ur = pKF2->mvuRight[idx2];
-            bool bStereo2 = kp2_ur>=0;
+            mpCurrentKeyFrame->AddMapPoint(pMP,idx1);
+            pKF2->AddMapPoint(pMP,idx2);
+            vbTriangulated1[idx1] = true;
 
-            // Check parallax between rays
-            cv::Mat xn1 = (cv::Mat_<float>(3,1) << (kp1.pt.x-cx1)*invfx1, (kp1.pt.y-cy1)*invfy1, 1.0);
-            cv::Mat xn2 = (cv::Mat_<float>(3,1) << (kp2.pt.x-cx2)*invfx2, (kp2.pt.y-cy2)*invfy2, 1.0);
+            pMP->ComputeDistinctiveDescriptors();
 
-            cv::Mat ray1 = Rwc1*xn1;
-            cv::Mat ray2 = Rwc2*xn2;
-            const float cosParallaxRays = ray1.dot(ray2)/(cv::norm(ray1)*cv::norm(ray2));
+            pMP->UpdateNormalAndDepth();
 
-            float cosParallaxStereo = cosParallaxRays+1;
-            float cosParallaxStereo1 = cosParallaxStereo;
-            float cosParallaxStereo2 = cosParallaxStereo;
+            mpMap->AddMapPoint(pMP);
+            mlpRecentAddedMapPoints.push_back(pMP);
 
-            if(bStereo1)
-                cosParallaxStereo1 = cos(2*atan2(mpCurrentKeyFrame->mb/2,mpCurrentKeyFrame->mvDepth[idx1]));
-            else if(bStereo2)
-                cosParallaxStereo2 = cos(2*atan2(pKF2->mb/2,pKF2->mvDepth[idx2]));
+            nnew++;
+        }
+    }
 
-            cosParallaxStereo = min(cosParallaxStereo1,cosParallaxStereo2);
+    mvvTriangulatedPoints.clear();
+}
 
-            cv::Mat x3D;
-            if(cosParallaxRays<cosParallaxStereo && cosParallaxRays>0 && (bStereo1 || bStereo2 || cosParallaxRays<0.9998))
-            {
-                // Linear Triangulation Method
-                cv::Mat A(4,4,CV_32F);
-                A.row(0) = xn1.at<float>(0)*Tcw1.row(2)-Tcw1.row(0);
-                A.row(1) = xn1.at<float>(1)*Tcw1.row(2)-Tcw1.row(1);
-                A.row(2) = xn2.at<float>(0)*Tcw2.row(2)-Tcw2.row(0);
-                A.row(3) = xn2.at<float>(1)*Tcw2.row(2)-Tcw2.row(1);
+void LocalMapping::TriangulateNeighbor(const int i)
+{
+    if(i>=mnTriangulationEnd)
+        return;
 
-                cv::Mat w,u,vt;
-                cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
+    // A new keyframe is waiting: finish the neighbors taken so far and skip the rest
+    if(i>0 && CheckNewKeyFrames())
+    {
+        int nEnd = mnTriangulationEnd;
+        while(i<nEnd && !mnTriangulationEnd.compare_exchange_weak(nEnd,i)) {}
+        return;
+    }
 
-                x3D = vt.row(3).t();
+    ORBmatcher matcher(0.6,false);
 
-                if(x3D.at<float>(3)==0)
-                    continue;
+    KeyFrame* pKF1 = mpCurrentKeyFrame;
 
-                // Euclidean coordinates
-                x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
+    const Eigen::Matrix3f Rcw1 = Converter::toMatrix3d(pKF1->GetRotation()).cast<float>();
+    const Eigen::Matrix3f Rwc1 = Rcw1.transpose();
+    const Eigen::Vector3f tcw1 = Converter::toVector3d(pKF1->GetTranslation()).cast<float>();
+    Eigen::Matrix<float,3,4> Tcw1;
+    Tcw1 << Rcw1, tcw1;
+    const Eigen::Vector3f Ow1 = Converter::toVector3d(pKF1->GetCameraCenter()).cast<float>();
 
-            }
-            else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)
-            {
-                x3D = mpCurrentKeyFrame->UnprojectStereo(idx1);                
-            }
-            else if(bStereo2 && cosParallaxStereo2<cosParallaxStereo1)
-            {
-                x3D = pKF2->UnprojectStereo(idx2);
-            }
-            else
-                continue; //No stereo and very low parallax
+    const float &fx1 = pKF1->fx;
+    const float &fy1 = pKF1->fy;
+    const float &cx1 = pKF1->cx;
+    const float &cy1 = pKF1->cy;
+    const float &invfx1 = pKF1->invfx;
+    const float &invfy1 = pKF1->invfy;
 
-            cv::Mat x3Dt = x3D.t();
+    const float ratioFactor = 1.5f*pKF1->mfScaleFactor;
 
-            //Check triangulation in front of cameras
-            float z1 = Rcw1.row(2).dot(x3Dt)+tcw1.at<float>(2);
-            if(z1<=0)
-                continue;
+    KeyFrame* pKF2 = mvpTriangulationKFs[i];
+    vector<TriangulatedPoint> &vTriangulated = mvvTriangulatedPoints[i];
 
-            float z2 = Rcw2.row(2).dot(x3Dt)+tcw2.at<float>(2);
-            if(z2<=0)
-                continue;
+    // Check first that baseline is not too short
+    const Eigen::Vector3f Ow2 = Converter::toVector3d(pKF2->GetCameraCenter()).cast<float>();
+    const float baseline = (Ow2-Ow1).norm();
 
-            //Check reprojection error in first keyframe
-            const float &sigmaSquare1 = mpCurrentKeyFrame->mvLevelSigma2[kp1.octave];
-            const float x1 = Rcw1.row(0).dot(x3Dt)+tcw1.at<float>(0);
-            const float y1 = Rcw1.row(1).dot(x3Dt)+tcw1.at<float>(1);
-            const float invz1 = 1.0/z1;
+    if(!mbMonocular)
+    {
+        if(baseline<pKF2->mb)
+        return;
+    }
+    else
+    {
+        const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
+        const float ratioBaselineDepth = baseline/medianDepthKF2;
 
-            if(!bStereo1)
-            {
-                float u1 = fx1*x1*invz1+cx1;
-                float v1 = fy1*y1*invz1+cy1;
-                float errX1 = u1 - kp1.pt.x;
-                float errY1 = v1 - kp1.pt.y;
-                if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)
-                    continue;
-            }
-            else
-            {
-                float u1 = fx1*x1*invz1+cx1;
-                float u1_r = u1 - mpCurrentKeyFrame->mbf*invz1;
-                float v1 = fy1*y1*invz1+cy1;
-                float errX1 = u1 - kp1.pt.x;
-                float errY1 = v1 - kp1.pt.y;
-                float errX1_r = u1_r - kp1_ur;
-                if((errX1*errX1+errY1*errY1+errX1_r*errX1_r)>7.8*sigmaSquare1)
-                    continue;
-            }
+        if(ratioBaselineDepth<0.01)
+            return;
+    }
 
-            //Check reprojection error in second keyframe
-            const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
-            const float x2 = Rcw2.row(0).dot(x3Dt)+tcw2.at<float>(0);
-            const float y2 = Rcw2.row(1).dot(x3Dt)+tcw2.at<float>(1);
-            const float invz2 = 1.0/z2;
-            if(!bStereo2)
-            {
-                float u2 = fx2*x2*invz2+cx2;
-                float v2 = fy2*y2*invz2+cy2;
-                float errX2 = u2 - kp2.pt.x;
-                float errY2 = v2 - kp2.pt.y;
-                if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)
-                    continue;
-            }
-            else
-            {
-                float u2 = fx2*x2*invz2+cx2;
-                float u2_r = u2 - mpCurrentKeyFrame->mbf*invz2;
-                float v2 = fy2*y2*invz2+cy2;
-                float errX2 = u2 - kp2.pt.x;
-                float errY2 = v2 - kp2.pt.y;
-                float errX2_r = u2_r - kp2_ur;
-                if((errX2*errX2+errY2*errY2+errX2_r*errX2_r)>7.8*sigmaSquare2)
-                    continue;
-            }
+    // Compute Fundamental Matrix
+    cv::Mat F12 = ComputeF12(pKF1,pKF2);
+
+    // Search matches that fullfil epipolar constraint
+    vector<pair<size_t,size_t> > vMatchedIndices;
+    matcher.SearchForTriangulation(pKF1,pKF2,F12,vMatchedIndices,false);
+
+    const Eigen::Matrix3f Rcw2 = Converter::toMatrix3d(pKF2->GetRotation()).cast<float>();
+    const Eigen::Matrix3f Rwc2 = Rcw2.transpose();
+    const Eigen::Vector3f tcw2 = Converter::toVector3d(pKF2->GetTranslation()).cast<float>();
+    Eigen::Matrix<float,3,4> Tcw2;
+    Tcw2 << Rcw2, tcw2;
+
+    const float &fx2 = pKF2->fx;
+    const float &fy2 = pKF2->fy;
+    const float &cx2 = pKF2->cx;
+    const float &cy2 = pKF2->cy;
+    const float &invfx2 = pKF2->invfx;
+    const float &invfy2 = pKF2->invfy;
+
+    // Triangulate each match
+    const int nmatches = vMatchedIndices.size();
+    vTriangulated.reserve(nmatches);
+    for(int ikp=0; ikp<nmatches; ikp++)
+    {
+        const int &idx1 = vMatchedIndices[ikp].first;
+        const int &idx2 = vMatchedIndices[ikp].second;
 
-            //Check scale consistency
-            cv::Mat normal1 = x3D-Ow1;
-            float dist1 = cv::norm(normal1);
+        const cv::KeyPoint &kp1 = pKF1->mvKeysUn[idx1];
+        const float kp1_ur=pKF1->mvuRight[idx1];
+        bool bStereo1 = kp1_ur>=0;
 
-            cv::Mat normal2 = x3D-Ow2;
-            float dist2 = cv::norm(normal2);
+        const cv::KeyPoint &kp2 = pKF2->mvKeysUn[idx2];
+        const float kp2_ur = pKF2->mvuRight[idx2];
+        bool bStereo2 = kp2_ur>=0;
 
-            if(dist1==0 || dist2==0)
-                continue;
+        // Check parallax between rays
+        const Eigen::Vector3f xn1((kp1.pt.x-cx1)*invfx1, (kp1.pt.y-cy1)*invfy1, 1.0f);
+        const Eigen::Vector3f xn2((kp2.pt.x-cx2)*invfx2, (kp2.pt.y-cy2)*invfy2, 1.0f);
+
+        const Eigen::Vector3f ray1 = Rwc1*xn1;
+        const Eigen::Vector3f ray2 = Rwc2*xn2;
+        const float cosParallaxRays = ray1.dot(ray2)/(ray1.norm()*ray2.norm());
 
-            const float ratioDist = dist2/dist1;
-            const float ratioOctave = mpCurrentKeyFrame->mvScaleFactors[kp1.octave]/pKF2->mvScaleFactors[kp2.octave];
+        float cosParallaxStereo = cosParallaxRays+1;
+        float cosParallaxStereo1 = cosParallaxStereo;
+        float cosParallaxStereo2 = cosParallaxStereo;
 
-            /*if(fabs(ratioDist-ratioOctave)>ratioFactor)
-                continue;*/
-            if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)
+        if(bStereo1)
+            cosParallaxStereo1 = cos(2*atan2(pKF1->mb/2,pKF1->mvDepth[idx1]));
+        else if(bStereo2)
+            cosParallaxStereo2 = cos(2*atan2(pKF2->mb/2,pKF2->mvDepth[idx2]));
+
+        cosParallaxStereo = min(cosParallaxStereo1,cosParallaxStereo2);
+
+        Eigen::Vector3f x3D;
+        if(cosParallaxRays<cosParallaxStereo && cosParallaxRays>0 && (bStereo1 || bStereo2 || cosParallaxRays<0.9998))
+        {
+            // Linear Triangulation Method
+            Eigen::Matrix4f A;
+            A.row(0) = xn1(0)*Tcw1.row(2)-Tcw1.row(0);
+            A.row(1) = xn1(1)*Tcw1.row(2)-Tcw1.row(1);
+            A.row(2) = xn2(0)*Tcw2.row(2)-Tcw2.row(0);
+            A.row(3) = xn2(1)*Tcw2.row(2)-Tcw2.row(1);
+
+            Eigen::JacobiSVD<Eigen::Matrix4f> svd(A,Eigen::ComputeFullV);
+            const Eigen::Vector4f x3Dh = svd.matrixV().col(3);
+
+            if(x3Dh(3)==0)
                 continue;
 
-            // Triangulation is succesfull
-            MapPoint* pMP = new MapPoint(x3D,mpCurrentKeyFrame,mpMap);
+            // Euclidean coordinates
+            x3D = x3Dh.head<3>()/x3Dh(3);
 
-            pMP->AddObservation(mpCurrentKeyFrame,idx1);            
-            pMP->AddObservation(pKF2,idx2);
+        }
+        else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)
+        {
+            x3D = Converter::toVector3d(pKF1->UnprojectStereo(idx1)).cast<float>();
+        }
+        else if(bStereo2 && cosParallaxStereo2<cosParallaxStereo1)
+        {
+            x3D = Converter::toVector3d(pKF2->UnprojectStereo(idx2)).cast<float>();
+        }
+        else
+            continue; //No stereo and very low parallax
 
-            mpCurrentKeyFrame->AddMapPoint(pMP,idx1);
-            pKF2->AddMapPoint(pMP,idx2);
+        //Check triangulation in front of cameras
+        const Eigen::Vector3f x3Dc1 = Rcw1*x3D+tcw1;
+        float z1 = x3Dc1(2);
+        if(z1<=0)
+            continue;
 
-            pMP->ComputeDistinctiveDescriptors();
+        const Eigen::Vector3f x3Dc2 = Rcw2*x3D+tcw2;
+        float z2 = x3Dc2(2);
+        if(z2<=0)
+            continue;
 
-            pMP->UpdateNormalAndDepth();
+        //Check reprojection error in first keyframe
+        const float &sigmaSquare1 = pKF1->mvLevelSigma2[kp1.octave];
+        const float x1 = x3Dc1(0);
+        const float y1 = x3Dc1(1);
+        const float invz1 = 1.0/z1;
 
-            mpMap->AddMapPoint(pMP);
-            mlpRecentAddedMapPoints.push_back(pMP);
+        if(!bStereo1)
+        {
+            float u1 = fx1*x1*invz1+cx1;
+            float v1 = fy1*y1*invz1+cy1;
+            float errX1 = u1 - kp1.pt.x;
+            float errY1 = v1 - kp1.pt.y;
+            if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)
+                continue;
+        }
+        else
+        {
+            float u1 = fx1*x1*invz1+cx1;
+            float u1_r = u1 - pKF1->mbf*invz1;
+            float v1 = fy1*y1*invz1+cy1;
+            float errX1 = u1 - kp1.pt.x;
+            float errY1 = v1 - kp1.pt.y;
+            float errX1_r = u1_r - kp1_ur;
+            if((errX1*errX1+errY1*errY1+errX1_r*errX1_r)>7.8*sigmaSquare1)
+                continue;
+        }
 
-            nnew++;
+        //Check reprojection error in second keyframe
+        const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
+        const float x2 = x3Dc2(0);
+        const float y2 = x3Dc2(1);
+        const float invz2 = 1.0/z2;
+        if(!bStereo2)
+        {
+            float u2 = fx2*x2*invz2+cx2;
+            float v2 = fy2*y2*invz2+cy2;
+            float errX2 = u2 - kp2.pt.x;
+            float errY2 = v2 - kp2.pt.y;
+            if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)
+                continue;
         }
+        else
+        {
+            float u2 = fx2*x2*invz2+cx2;
+            float u2_r = u2 - pKF1->mbf*invz2;
+            float v2 = fy2*y2*invz2+cy2;
+            float errX2 = u2 - kp2.pt.x;
+            float errY2 = v2 - kp2.pt.y;
+            float errX2_r = u2_r - kp2_ur;
+            if((errX2*errX2+errY2*errY2+errX2_r*errX2_r)>7.8*sigmaSquare2)
+                continue;
+        }
+
+        //Check scale consistency
+        float dist1 = (x3D-Ow1).norm();
+        float dist2 = (x3D-Ow2).norm();
+
+        if(dist1==0 || dist2==0)
+            continue;
+
+        const float ratioDist = dist2/dist1;
+        const float ratioOctave = pKF1->mvScaleFactors[kp1.octave]/pKF2->mvScaleFactors[kp2.octave];
+
+        /*if(fabs(ratioDist-ratioOctave)>ratioFactor)
+            continue;*/
+        if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)
+            continue;
+
+        TriangulatedPoint point;
+        point.idx1 = idx1;
+        point.idx2 = idx2;
+        point.x3D = x3D;
+        vTriangulated.push_back(point);
     }
 }
 
@@ -469,10 +553,11 @@ void LocalMapping::SearchInNeighbors()
         pKFi->mnFuseTargetForKF = mpCurrentKeyFrame->mnId;
 
         // Extend to some second neighbors
-        const vector<KeyFrame*> vpSecondNeighKFs = pKFi->GetBestCovisibilityKeyFrames(5);
-        for(vector<KeyFrame*>::const_iterator vit2=vpSecondNeighKFs.begin(), vend2=vpSecondNeighKFs.end(); vit2!=vend2; vit2++)
+        const CovisibilityListPtr pSecondNeighs = pKFi->GetCovisibilityList();
+        const size_t nSecondNeighs = min<size_t>(pSecondNeighs->vpKeyFrames.size(),5);
+        for(size_t i2=0; i2<nSecondNeighs; i2++)
         {
-            KeyFrame* pKFi2 = *vit2;
+            KeyFrame* pKFi2 = pSecondNeighs->vpKeyFrames[i2];
             if(pKFi2->isBad() || pKFi2->mnFuseTargetForKF==mpCurrentKeyFrame->mnId || pKFi2->mnId==mpCurrentKeyFrame->mnId)
                 continue;
             vpTargetKFs.push_back(pKFi2);
@@ -480,15 +565,20 @@ void LocalMapping::SearchInNeighbors()
     }
 
 
-    // Search matches by projection from current KF in target KFs
+    // Search matches by projection from current KF in target KFs.
+    // The search runs in parallel by target KF, the fusion is done in order as in ORBmatcher::Fuse.
     ORBmatcher matcher;
     vector<MapPoint*> vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
-    for(vector<KeyFrame*>::iterator vit=vpTargetKFs.begin(), vend=vpTargetKFs.end(); vit!=vend; vit++)
+    vector<vector<int> > vvnFuseIdx(vpTargetKFs.size(),vector<int>(vpMapPointMatches.size()));
+    RunParallel(vpTargetKFs.size(),[&](const int i)
     {
-        KeyFrame* pKFi = *vit;
+        ORBmatcher threadMatcher;
+        threadMatcher.SearchFuse(vpTargetKFs[i],vpMapPointMatches,0,vpMapPointMatches.size(),vvnFuseIdx[i]);
+    });
 
-        matcher.Fuse(pKFi,vpMapPointMatches);
-    }
+    set<MapPoint*> spChanged;
+    for(size_t i=0; i<vpTargetKFs.size(); i++)
+        matcher.ApplyFuse(vpTargetKFs[i],vpMapPointMatches,vvnFuseIdx[i],spChanged);
 
     // Search matches by projection from target KFs in current KF
     vector<MapPoint*> vpFuseCandidates;
@@ -512,28 +602,62 @@ void LocalMapping::SearchInNeighbors()
         }
     }
 
-    matcher.Fuse(mpCurrentKeyFrame,vpFuseCandidates);
+    const size_t nCandidates = vpFuseCandidates.size();
+    const int nBlocks = (nCandidates+FUSE_BLOCK_SIZE-1)/FUSE_BLOCK_SIZE;
+    vector<int> vnFuseIdx(nCandidates);
+    RunParallel(nBlocks,[&](const int i)
+    {
+        ORBmatcher threadMatcher;
+        threadMatcher.SearchFuse(mpCurrentKeyFrame,vpFuseCandidates,i*FUSE_BLOCK_SIZE,min(nCandidates,(i+1)*FUSE_BLOCK_SIZE),vnFuseIdx);
+    });
 
+    spChanged.clear();
+    matcher.ApplyFuse(mpCurrentKeyFrame,vpFuseCandidates,vnFuseIdx,spChanged);
 
-    // Update points
+
+    // Update points. Each one only reads its observations, so they are updated in parallel.
     vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
-    for(size_t i=0, iend=vpMapPointMatches.size(); i<iend; i++)
+    const size_t nMPs = vpMapPointMatches.size();
+    RunParallel((nMPs+FUSE_BLOCK_SIZE-1)/FUSE_BLOCK_SIZE,[&](const int i)
     {
-        MapPoint* pMP=vpMapPointMatches[i];
-        if(pMP)
+        for(size_t j=i*FUSE_BLOCK_SIZE, jend=min(nMPs,(i+1)*FUSE_BLOCK_SIZE); j<jend; j++)
         {
-            if(!pMP->isBad())
+            MapPoint* pMP=vpMapPointMatches[j];
+            if(pMP)
             {
-                pMP->ComputeDistinctiveDescriptors();
-                pMP->UpdateNormalAndDepth();
+                if(!pMP->isBad())
+                {
+                    pMP->ComputeDistinctiveDescriptors();
+                    pMP->UpdateNormalAndDepth();
+                }
             }
         }
-    }
+    });
 
     // Update connections in covisibility graph
     mpCurrentKeyFrame->UpdateConnections();
 }
 
+void LocalMapping::RunParallel(const int nJobs, const function<void(int)> &job)
+{
+    atomic<int> nNextJob(0);
+    function<void()> worker = [&]()
+    {
+        for(int i=nNextJob++; i<nJobs; i=nNextJob++)
+            job(i);
+    };
+
+    const int nWorkers = max(1,min(nJobs,min(4,(int)thread::hardware_concurrency())));
+
+    vector<thread> vWorkers;
+    vWorkers.reserve(nWorkers-1);
+    for(int i=1; i<nWorkers; i++)
+        vWorkers.push_back(thread(worker));
+    worker();
+    for(size_t i=0; i<vWorkers.size(); i++)
+        vWorkers[i].join();
+}
+
 cv::Mat LocalMapping::ComputeF12(KeyFrame *&pKF1, KeyFrame *&pKF2)
 {
     cv::Mat R1w = pKF1->GetRotation();
@@ -555,23 +679,28 @@ cv::Mat LocalMapping::ComputeF12(KeyFrame *&pKF1, KeyFrame *&pKF2)
 
 void LocalMapping::RequestStop()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    mbStopRequested = true;
-    unique_lock<mutex> lock2(mMutexNewKFs);
-    mbAbortBA = true;
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        mbStopRequested = true;
+        unique_lock<mutex> lock2(mMutexNewKFs);
+        mbAbortBA = true;
+    }
+    WakeUp();
 }
 
 bool LocalMapping::Stop()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    if(mbStopRequested && !mbNotStop)
     {
+        unique_lock<mutex> lock(mMutexStop);
+        if(!mbStopRequested || mbNotStop)
+            return false;
+
         mbStopped = true;
         cout << "Local Mapping STOP" << endl;
-        return true;
     }
+    WakeUp();
 
-    return false;
+    return true;
 }
 
 bool LocalMapping::isStopped()
@@ -586,19 +715,30 @@ bool LocalMapping::stopRequested()
     return mbStopRequested;
 }
 
+void LocalMapping::WaitUntilStopped()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    while(!isStopped())
+        mcvWakeUp.wait(lock);
+}
+
 void LocalMapping::Release()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    unique_lock<mutex> lock2(mMutexFinish);
-    if(mbFinished)
-        return;
-    mbStopped = false;
-    mbStopRequested = false;
-    for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
-        delete *lit;
-    mlNewKeyFrames.clear();
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        unique_lock<mutex> lock2(mMutexFinish);
+        if(mbFinished)
+            return;
+        mbStopped = false;
+        mbStopRequested = false;
+        for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
+            delete *lit;
+        mlNewKeyFrames.clear();
+        mlNewKeyFrameTimes.clear();
 
-    cout << "Local Mapping RELEASE" << endl;
+        cout << "Local Mapping RELEASE" << endl;
+    }
+    WakeUp();
 }
 
 bool LocalMapping::AcceptKeyFrames()
@@ -609,18 +749,39 @@ bool LocalMapping::AcceptKeyFrames()
 
 void LocalMapping::SetAcceptKeyFrames(bool flag)
 {
-    unique_lock<mutex> lock(mMutexAccept);
-    mbAcceptKeyFrames=flag;
+    {
+        unique_lock<mutex> lock(mMutexAccept);
+        mbAcceptKeyFrames=flag;
+    }
+    WakeUp();
+}
+
+bool LocalMapping::isIdle()
+{
+    return !isStopped() && !stopRequested() && KeyframesInQueue()==0 && AcceptKeyFrames();
+}
+
+void LocalMapping::WaitUntilIdle()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    while(!isIdle() && !isFinished())
+        mcvWakeUp.wait(lock);
 }
 
 bool LocalMapping::SetNotStop(bool flag)
 {
-    unique_lock<mutex> lock(mMutexStop);
+    {
+        unique_lock<mutex> lock(mMutexStop);
+
+        if(flag && mbStopped)
+            return false;
 
-    if(flag && mbStopped)
-        return false;
+        mbNotStop = flag;
+    }
 
-    mbNotStop = flag;
+    // A stop request may have been waiting for this
+    if(!flag)
+        WakeUp();
 
     return true;
 }
@@ -632,68 +793,92 @@ void LocalMapping::InterruptBA()
 
 void LocalMapping::KeyFrameCulling()
 {
+    ScopedTimer timer(Stats::KEYFRAME_CULLING);
+
     // Check redundant keyframes (only local keyframes)
     // A keyframe is considered redundant if the 90% of the MapPoints it sees, are seen
     // in at least other 3 keyframes (in the same or finer scale)
     // We only consider close stereo points
-    vector<KeyFrame*> vpLocalKeyFrames = mpCurrentKeyFrame->GetVectorCovisibleKeyFrames();
+    const vector<KeyFrame*> vpLocalKeyFrames = mpCurrentKeyFrame->GetVectorCovisibleKeyFrames();
 
-    for(vector<KeyFrame*>::iterator vit=vpLocalKeyFrames.begin(), vend=vpLocalKeyFrames.end(); vit!=vend; vit++)
+    // The check of every keyframe runs in parallel over the current state of the map
+    vector<char> vbRedundant(vpLocalKeyFrames.size(),false);
+    RunParallel(vpLocalKeyFrames.size(),[&](const int i)
     {
-        KeyFrame* pKF = *vit;
+        if(vpLocalKeyFrames[i]->mnId!=0)
+            vbRedundant[i] = IsRedundant(vpLocalKeyFrames[i]);
+    });
+
+    // Culling is applied in order. Once a keyframe is culled the observations of its points
+    // have changed, so the following keyframes are checked again as in the serial version.
+    bool bCulled = false;
+    for(size_t i=0, iend=vpLocalKeyFrames.size(); i<iend; i++)
+    {
+        KeyFrame* pKF = vpLocalKeyFrames[i];
         if(pKF->mnId==0)
             continue;
-        const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
 
-        int nObs = 3;
-        const int thObs=nObs;
-        int nRedundantObservations=0;
-        int nMPs=0;
-        for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+        const bool bRedundant = bCulled ? IsRedundant(pKF) : vbRedundant[i];
+        if(bRedundant)
         {
-            MapPoint* pMP = vpMapPoints[i];
-            if(pMP)
+            pKF->SetBadFlag();
+            if(pKF->isBad())
+                bCulled = true;
+        }
+    }
+}
+
+bool LocalMapping::IsRedundant(KeyFrame* pKF)
+{
+    const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
+
+    int nObs = 3;
+    const int thObs=nObs;
+    int nRedundantObservations=0;
+    int nMPs=0;
+    for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
+        if(pMP)
+        {
+            if(!pMP->isBad())
             {
-                if(!pMP->isBad())
+                if(!mbMonocular)
+                {
+                    if(pKF->mvDepth[i]>pKF->mThDepth || pKF->mvDepth[i]<0)
+                        continue;
+                }
+
+                nMPs++;
+                if(pMP->Observations()>thObs)
                 {
-                    if(!mbMonocular)
+                    const int &scaleLevel = pKF->mvKeysUn[i].octave;
+                    const map<KeyFrame*, size_t> observations = pMP->GetObservations();
+                    int nObs=0;
+                    for(map<KeyFrame*, size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
                     {
-                        if(pKF->mvDepth[i]>pKF->mThDepth || pKF->mvDepth[i]<0)
+                        KeyFrame* pKFi = mit->first;
+                        if(pKFi==pKF)
                             continue;
-                    }
+                        const int &scaleLeveli = pKFi->mvKeysUn[mit->second].octave;
 
-                    nMPs++;
-                    if(pMP->Observations()>thObs)
-                    {
-                        const int &scaleLevel = pKF->mvKeysUn[i].octave;
-                        const map<KeyFrame*, size_t> observations = pMP->GetObservations();
-                        int nObs=0;
-                        for(map<KeyFrame*, size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-                        {
-                            KeyFrame* pKFi = mit->first;
-                            if(pKFi==pKF)
-                                continue;
-                            const int &scaleLeveli = pKFi->mvKeysUn[mit->second].octave;
-
-                            if(scaleLeveli<=scaleLevel+1)
-                            {
-                                nObs++;
-                                if(nObs>=thObs)
-                                    break;
-                            }
-                        }
-                        if(nObs>=thObs)
+                        if(scaleLeveli<=scaleLevel+1)
                         {
-                            nRedundantObservations++;
+                            nObs++;
+                            if(nObs>=thObs)
+                                break;
                         }
                     }
+                    if(nObs>=thObs)
+                    {
+                        nRedundantObservations++;
+                    }
                 }
             }
-        }  
+        }
+    }  
 
-        if(nRedundantObservations>0.9*nMPs)
-            pKF->SetBadFlag();
-    }
+    return nRedundantObservations>0.9*nMPs;
 }
 
 cv::Mat LocalMapping::SkewSymmetricMatrix(const cv::Mat &v)
@@ -709,33 +894,41 @@ void LocalMapping::RequestReset()
         unique_lock<mutex> lock(mMutexReset);
         mbResetRequested = true;
     }
+    WakeUp();
 
-    while(1)
-    {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetRequested)
-                break;
-        }
-        usleep(3000);
-    }
+    unique_lock<mutex> lock(mMutexWakeUp);
+    while(CheckResetRequested())
+        mcvWakeUp.wait(lock);
 }
 
-void LocalMapping::ResetIfRequested()
+bool LocalMapping::CheckResetRequested()
 {
     unique_lock<mutex> lock(mMutexReset);
-    if(mbResetRequested)
+    return mbResetRequested;
+}
+
+void LocalMapping::ResetIfRequested()
+{
     {
+        unique_lock<mutex> lock(mMutexReset);
+        if(!mbResetRequested)
+            return;
+
         mlNewKeyFrames.clear();
+        mlNewKeyFrameTimes.clear();
         mlpRecentAddedMapPoints.clear();
         mbResetRequested=false;
     }
+    WakeUp();
 }
 
 void LocalMapping::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    WakeUp();
 }
 
 bool LocalMapping::CheckFinish()
@@ -746,10 +939,13 @@ bool LocalMapping::CheckFinish()
 
 void LocalMapping::SetFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinished = true;    
-    unique_lock<mutex> lock2(mMutexStop);
-    mbStopped = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinished = true;    
+        unique_lock<mutex> lock2(mMutexStop);
+        mbStopped = true;
+    }
+    WakeUp();
 }
 
 bool LocalMapping::isFinished()
@@ -758,4 +954,11 @@ bool LocalMapping::isFinished()
     return mbFinished;
 }
 
+void LocalMapping::WaitUntilFinished()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    while(!isFinished())
+        mcvWakeUp.wait(lock);
+}
+
 } //namespace ORB_SLAM
@@ -28,7 +28,7 @@
 
 #include "ORBmatcher.h"
 
-#include <unistd.h>
+#include "Stats.h"
 
 #include<mutex>
 #include<thread>
@@ -37,10 +37,14 @@
 namespace ORB_SLAM2
 {
 
+const size_t LoopClosing::GBA_MERGE_CHUNK = 5000;
+
 LoopClosing::LoopClosing(Map *pMap, KeyFrameDatabase *pDB, ORBVocabulary *pVoc, const bool bFixScale):
     mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
-    mpKeyFrameDB(pDB), mpORBVocabulary(pVoc), mpMatchedKF(NULL), mLastLoopKFid(0), mbRunningGBA(false), mbFinishedGBA(true),
-    mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale), mnFullBAIdx(0)
+    mpKeyFrameDB(pDB), mpORBVocabulary(pVoc), mbProcessingKeyFrame(false), mpMatchedKF(NULL),
+    mnNextSim3Candidate(0), mnSim3Winner(-1), mLastLoopKFid(0), mbRunningGBA(false), mbFinishedGBA(true),
+    mbStopGBA(false), mpThreadGBA(NULL), mnGBAIteration(0), mbPendingGBAMerge(false), mnPendingGBALoopKF(0),
+    mbFixScale(bFixScale), mbDeterministic(false)
 {
     mnCovisibilityConsistencyTh = 3;
 }
@@ -55,6 +59,11 @@ void LoopClosing::SetLocalMapper(LocalMapping *pLocalMapper)
     mpLocalMapper=pLocalMapper;
 }
 
+void LoopClosing::SetDeterministic(const bool flag)
+{
+    mbDeterministic = flag;
+}
+
 
 void LoopClosing::Run()
 {
@@ -76,6 +85,12 @@ void LoopClosing::Run()
                    CorrectLoop();
                }
             }
+
+            {
+                unique_lock<mutex> lock(mMutexLoopQueue);
+                mbProcessingKeyFrame = false;
+            }
+            WakeUp();
         }       
 
         ResetIfRequested();
@@ -83,7 +98,12 @@ void LoopClosing::Run()
         if(CheckFinish())
             break;
 
-        usleep(5000);
+        // Sleep until a keyframe is inserted or a reset or finish is requested
+        {
+            unique_lock<mutex> lock(mMutexWakeUp);
+            while(!CheckNewKeyFrames() && !CheckFinish() && !CheckResetRequested())
+                mcvWakeUp.wait(lock);
+        }
     }
 
     SetFinish();
@@ -91,9 +111,19 @@ void LoopClosing::Run()
 
 void LoopClosing::InsertKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexLoopQueue);
-    if(pKF->mnId!=0)
+    {
+        unique_lock<mutex> lock(mMutexLoopQueue);
+        if(pKF->mnId==0)
+            return;
         mlpLoopKeyFrameQueue.push_back(pKF);
+    }
+    WakeUp();
+}
+
+void LoopClosing::WakeUp()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    mcvWakeUp.notify_all();
 }
 
 bool LoopClosing::CheckNewKeyFrames()
@@ -104,10 +134,13 @@ bool LoopClosing::CheckNewKeyFrames()
 
 bool LoopClosing::DetectLoop()
 {
+    ScopedTimer timer(Stats::DETECT_LOOP);
+
     {
         unique_lock<mutex> lock(mMutexLoopQueue);
         mpCurrentKF = mlpLoopKeyFrameQueue.front();
         mlpLoopKeyFrameQueue.pop_front();
+        mbProcessingKeyFrame = true;
         // Avoid that a keyframe can be erased while it is being process by this thread
         mpCurrentKF->SetNotErase();
     }
@@ -232,118 +265,38 @@ bool LoopClosing::DetectLoop()
 
 bool LoopClosing::ComputeSim3()
 {
+    ScopedTimer timer(Stats::COMPUTE_SIM3);
+
     // For each consistent loop candidate we try to compute a Sim3
 
     const int nInitialCandidates = mvpEnoughConsistentCandidates.size();
 
-    // We compute first ORB matches for each candidate
-    // If enough matches are found, we setup a Sim3Solver
-    ORBmatcher matcher(0.75,true);
-
-    vector<Sim3Solver*> vpSim3Solvers;
-    vpSim3Solvers.resize(nInitialCandidates);
-
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nInitialCandidates);
-
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nInitialCandidates);
-
-    int nCandidates=0; //candidates with enough matches
-
+    // avoid that local mapping erase the candidates while they are being processed in this thread
     for(int i=0; i<nInitialCandidates; i++)
-    {
-        KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
-
-        // avoid that local mapping erase it while it is being processed in this thread
-        pKF->SetNotErase();
-
-        if(pKF->isBad())
-        {
-            vbDiscarded[i] = true;
-            continue;
-        }
-
-        int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vvpMapPointMatches[i]);
-
-        if(nmatches<20)
-        {
-            vbDiscarded[i] = true;
-            continue;
-        }
-        else
-        {
-            Sim3Solver* pSolver = new Sim3Solver(mpCurrentKF,pKF,vvpMapPointMatches[i],mbFixScale);
-            pSolver->SetRansacParameters(0.99,20,300);
-            vpSim3Solvers[i] = pSolver;
-        }
-
-        nCandidates++;
-    }
-
-    bool bMatch = false;
-
-    // Perform alternatively RANSAC iterations for each candidate
-    // until one is succesful or all fail
-    while(nCandidates>0 && !bMatch)
-    {
-        for(int i=0; i<nInitialCandidates; i++)
-        {
-            if(vbDiscarded[i])
-                continue;
-
-            KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
-
-            // Perform 5 Ransac Iterations
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bNoMore;
-
-            Sim3Solver* pSolver = vpSim3Solvers[i];
-            cv::Mat Scm  = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
-
-            // If Ransac reachs max. iterations discard keyframe
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
-
-            // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
-            if(!Scm.empty())
-            {
-                vector<MapPoint*> vpMapPointMatches(vvpMapPointMatches[i].size(), static_cast<MapPoint*>(NULL));
-                for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
-                {
-                    if(vbInliers[j])
-                       vpMapPointMatches[j]=vvpMapPointMatches[i][j];
-                }
-
-                cv::Mat R = pSolver->GetEstimatedRotation();
-                cv::Mat t = pSolver->GetEstimatedTranslation();
-                const float s = pSolver->GetEstimatedScale();
-                matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,R,t,7.5);
-
-                g2o::Sim3 gScm(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
-                const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMapPointMatches, gScm, 10, mbFixScale);
-
-                // If optimization is succesful stop ransacs and continue
-                if(nInliers>=20)
-                {
-                    bMatch = true;
-                    mpMatchedKF = pKF;
-                    g2o::Sim3 gSmw(Converter::toMatrix3d(pKF->GetRotation()),Converter::toVector3d(pKF->GetTranslation()),1.0);
-                    mg2oScw = gScm*gSmw;
-                    mScw = Converter::toCvMat(mg2oScw);
-
-                    mvpCurrentMatchedPoints = vpMapPointMatches;
-                    break;
-                }
-            }
-        }
-    }
-
-    if(!bMatch)
+        mvpEnoughConsistentCandidates[i]->SetNotErase();
+
+    // Candidates are evaluated in parallel, each worker matches a candidate and runs RANSAC
+    // on it until it succeeds or fails, then takes the next one. The first candidate with a
+    // valid Sim3 stops the others. In deterministic mode a single worker takes them in order
+    mnNextSim3Candidate = 0;
+    mnSim3Winner = -1;
+    mvSim3Scm.assign(nInitialCandidates,g2o::Sim3());
+    mvvpSim3Matches.assign(nInitialCandidates,vector<MapPoint*>());
+
+    int nWorkers = 1;
+    if(!mbDeterministic)
+        nWorkers = max(1,min(nInitialCandidates,min(4,(int)thread::hardware_concurrency())));
+
+    vector<thread> vWorkers;
+    vWorkers.reserve(nWorkers-1);
+    for(int i=1; i<nWorkers; i++)
+        vWorkers.push_back(thread(&LoopClosing::RunSim3Worker,this));
+    RunSim3Worker();
+    for(size_t i=0; i<vWorkers.size(); i++)
+        vWorkers[i].join();
+
+    const int nWinner = mnSim3Winner;
+    if(nWinner<0)
     {
         for(int i=0; i<nInitialCandidates; i++)
              mvpEnoughConsistentCandidates[i]->SetErase();
@@ -351,6 +304,14 @@ bool LoopClosing::ComputeSim3()
         return false;
     }
 
+    mpMatchedKF = mvpEnoughConsistentCandidates[nWinner];
+    g2o::Sim3 gSmw(Converter::toMatrix3d(mpMatchedKF->GetRotation()),Converter::toVector3d(mpMatchedKF->GetTranslation()),1.0);
+    mg2oScw = mvSim3Scm[nWinner]*gSmw;
+    mScw = Converter::toCvMat(mg2oScw);
+    mvpCurrentMatchedPoints = mvvpSim3Matches[nWinner];
+
+    ORBmatcher matcher(0.75,true);
+
     // Retrieve MapPoints seen in Loop Keyframe and neighbors
     vector<KeyFrame*> vpLoopConnectedKFs = mpMatchedKF->GetVectorCovisibleKeyFrames();
     vpLoopConnectedKFs.push_back(mpMatchedKF);
@@ -401,33 +362,99 @@ bool LoopClosing::ComputeSim3()
 
 }
 
-void LoopClosing::CorrectLoop()
+void LoopClosing::RunSim3Worker()
 {
-    cout << "Loop detected!" << endl;
+    ORBmatcher matcher(0.75,true);
 
-    // Send a stop signal to Local Mapping
-    // Avoid new keyframes are inserted while correcting the loop
-    mpLocalMapper->RequestStop();
+    const int nInitialCandidates = mvpEnoughConsistentCandidates.size();
 
-    // If a Global Bundle Adjustment is running, abort it
-    if(isRunningGBA())
+    while(mnSim3Winner<0)
     {
-        unique_lock<mutex> lock(mMutexGBA);
-        mbStopGBA = true;
+        const int i = mnNextSim3Candidate++;
+        if(i>=nInitialCandidates)
+            break;
+
+        KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
+
+        if(pKF->isBad())
+            continue;
+
+        // We compute first ORB matches
+        // If enough matches are found, we setup a Sim3Solver
+        vector<MapPoint*> vpMapPointMatches12;
+        int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vpMapPointMatches12);
+
+        if(nmatches<20)
+            continue;
 
-        mnFullBAIdx++;
+        Sim3Solver solver(mpCurrentKF,pKF,vpMapPointMatches12,mbFixScale);
+        solver.SetRansacParameters(0.99,20,300);
 
-        if(mpThreadGBA)
+        // Perform 5 Ransac Iterations at a time until the candidate succeeds, RANSAC
+        // reaches max. iterations or another candidate wins
+        bool bNoMore = false;
+        while(!bNoMore && mnSim3Winner<0)
         {
-            mpThreadGBA->detach();
-            delete mpThreadGBA;
+            vector<bool> vbInliers;
+            int nInliers;
+
+            cv::Mat Scm  = solver.iterate(5,bNoMore,vbInliers,nInliers);
+
+            // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
+            if(!Scm.empty())
+            {
+                vector<MapPoint*> vpMapPointMatches(vpMapPointMatches12.size(), static_cast<MapPoint*>(NULL));
+                for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
+                {
+                    if(vbInliers[j])
+                       vpMapPointMatches[j]=vpMapPointMatches12[j];
+                }
+
+                cv::Mat R = solver.GetEstimatedRotation();
+                cv::Mat t = solver.GetEstimatedTranslation();
+                const float s = solver.GetEstimatedScale();
+                matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,R,t,7.5);
+
+                g2o::Sim3 gScm(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
+                const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMapPointMatches, gScm, 10, mbFixScale);
+
+                // If optimization is succesful stop ransacs and continue
+                if(nInliers>=20)
+                {
+                    mvSim3Scm[i] = gScm;
+                    mvvpSim3Matches[i] = vpMapPointMatches;
+
+                    int nNoWinner = -1;
+                    mnSim3Winner.compare_exchange_strong(nNoWinner,i);
+                    return;
+                }
+            }
         }
     }
+}
+
+void LoopClosing::CorrectLoop()
+{
+    ScopedTimer timer(Stats::CORRECT_LOOP);
+
+    cout << "Loop detected!" << endl;
+
+    // If a Global Bundle Adjustment is running, stop it. This is done first because a Global BA
+    // that is already merging its result stops and releases Local Mapping itself.
+    StopGlobalBundleAdjustment();
+
+    // Send a stop signal to Local Mapping
+    // Avoid new keyframes are inserted while correcting the loop
+    mpLocalMapper->RequestStop();
 
     // Wait until Local Mapping has effectively stopped
-    while(!mpLocalMapper->isStopped())
+    mpLocalMapper->WaitUntilStopped();
+
+    // Keep the progress of the stopped Global BA, the loop is corrected on top of it
+    if(mbPendingGBAMerge)
     {
-        usleep(1000);
+        MergeGlobalBundleAdjustment(mnPendingGBALoopKF);
+        mbPendingGBAMerge = false;
     }
 
     // Ensure current keyframe is updated
@@ -565,10 +592,28 @@ void LoopClosing::CorrectLoop()
         }
     }
 
+    // The essential graph optimization is the expensive part of the correction. It works on a snapshot
+    // of the keyframe poses, so Local Mapping is released and keeps processing keyframes meanwhile.
+    mpLocalMapper->Release();
+
     // Optimize graph
-    Optimizer::OptimizeEssentialGraph(mpMap, mpMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, mbFixScale);
+    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vScw, vCorrectedSiw;
+    vector<bool> vbOptimized;
+    Optimizer::OptimizeEssentialGraph(mpMap, mpMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, mbFixScale,
+                                      vScw, vCorrectedSiw, vbOptimized);
 
-    mpMap->InformNewBigChange();
+    // Stop Local Mapping again, only while the optimized poses are written to the map
+    mpLocalMapper->RequestStop();
+    mpLocalMapper->WaitUntilStopped();
+
+    {
+        // Get Map Mutex
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+
+        ApplyEssentialGraph(vScw, vCorrectedSiw, vbOptimized);
+
+        mpMap->InformNewBigChange();
+    }
 
     // Add loop edge
     mpMatchedKF->AddLoopEdge(mpCurrentKF);
@@ -583,9 +628,118 @@ void LoopClosing::CorrectLoop()
     // Loop closed. Release Local Mapping.
     mpLocalMapper->Release();    
 
+    // Global BA stops Local Mapping when it finishes, so it must be released before waiting
+    if(mbDeterministic)
+        mpThreadGBA->join();
+
     mLastLoopKFid = mpCurrentKF->mnId;   
 }
 
+void LoopClosing::ApplyEssentialGraph(const vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vScw,
+                                      const vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vCorrectedSiw,
+                                      const vector<bool> &vbOptimized)
+{
+    const unsigned long nMaxKFid = vbOptimized.size()-1;
+
+    // Keyframes in the graph get the optimized pose, keeping the motion Local Bundle Adjustment
+    // gave them while the graph was optimized. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
+    // Keyframes inserted meanwhile are corrected with their parent in the spanning tree.
+    map<KeyFrame*,cv::Mat> NonCorrectedTcw, CorrectedTcw;
+
+    list<KeyFrame*> lpKFtoCheck(mpMap->mvpKeyFrameOrigins.begin(),mpMap->mvpKeyFrameOrigins.end());
+
+    while(!lpKFtoCheck.empty())
+    {
+        KeyFrame* pKF = lpKFtoCheck.front();
+        lpKFtoCheck.pop_front();
+
+        const cv::Mat Tcw = pKF->GetPose();
+
+        if(pKF->mnId<=nMaxKFid && vbOptimized[pKF->mnId])
+        {
+            const g2o::Sim3 &Siw = vScw[pKF->mnId];
+            const Eigen::Matrix3d Rwi = Siw.rotation().toRotationMatrix().transpose();
+            const Eigen::Vector3d twi = -Rwi*Siw.translation()/Siw.scale();
+
+            const g2o::Sim3 &CorrectedSiw = vCorrectedSiw[pKF->mnId];
+            const Eigen::Matrix3d eigR = CorrectedSiw.rotation().toRotationMatrix();
+            const Eigen::Vector3d eigt = CorrectedSiw.translation()/CorrectedSiw.scale();
+
+            CorrectedTcw[pKF] = Tcw*Converter::toCvSE3(Rwi,twi)*Converter::toCvSE3(eigR,eigt);
+        }
+        else if(!CorrectedTcw.count(pKF))
+        {
+            CorrectedTcw[pKF] = Tcw.clone();
+        }
+
+        NonCorrectedTcw[pKF] = Tcw;
+
+        const cv::Mat Twc = pKF->GetPoseInverse();
+        const set<KeyFrame*> sChilds = pKF->GetChilds();
+        for(set<KeyFrame*>::const_iterator sit=sChilds.begin();sit!=sChilds.end();sit++)
+        {
+            KeyFrame* pChild = *sit;
+            if(pChild->mnId>nMaxKFid || !vbOptimized[pChild->mnId])
+            {
+                cv::Mat Tchildc = pChild->GetPose()*Twc;
+                CorrectedTcw[pChild] = Tchildc*CorrectedTcw[pKF];
+            }
+            lpKFtoCheck.push_back(pChild);
+        }
+
+        pKF->SetPose(CorrectedTcw[pKF]);
+    }
+
+    // Correct points. Transform to "non-optimized" reference keyframe pose and transform back with optimized pose
+    const vector<MapPoint*> vpMPs = mpMap->GetAllMapPoints();
+
+    for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+
+        if(pMP->isBad())
+            continue;
+
+        KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+
+        long unsigned int nIDr = pRefKF->mnId;
+        if(pMP->mnCorrectedByKF==mpCurrentKF->mnId && pMP->mnCorrectedReference<=nMaxKFid && vbOptimized[pMP->mnCorrectedReference])
+            nIDr = pMP->mnCorrectedReference;
+
+        if(nIDr<=nMaxKFid && vbOptimized[nIDr])
+        {
+            const g2o::Sim3 &Srw = vScw[nIDr];
+            const g2o::Sim3 correctedSwr = vCorrectedSiw[nIDr].inverse();
+
+            cv::Mat P3Dw = pMP->GetWorldPos();
+            Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
+            Eigen::Matrix<double,3,1> eigCorrectedP3Dw = correctedSwr.map(Srw.map(eigP3Dw));
+
+            pMP->SetWorldPos(Converter::toCvMat(eigCorrectedP3Dw));
+        }
+        else
+        {
+            map<KeyFrame*,cv::Mat>::const_iterator mit = NonCorrectedTcw.find(pRefKF);
+            if(mit==NonCorrectedTcw.end())
+                continue;
+
+            // Map to non-corrected camera
+            cv::Mat Rcw = mit->second.rowRange(0,3).colRange(0,3);
+            cv::Mat tcw = mit->second.rowRange(0,3).col(3);
+            cv::Mat Xc = Rcw*pMP->GetWorldPos()+tcw;
+
+            // Backproject using corrected camera
+            cv::Mat Twc = pRefKF->GetPoseInverse();
+            cv::Mat Rwc = Twc.rowRange(0,3).colRange(0,3);
+            cv::Mat twc = Twc.rowRange(0,3).col(3);
+
+            pMP->SetWorldPos(Rwc*Xc+twc);
+        }
+
+        pMP->UpdateNormalAndDepth();
+    }
+}
+
 void LoopClosing::SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap)
 {
     ORBmatcher matcher(0.8);
@@ -621,139 +775,186 @@ void LoopClosing::RequestReset()
         unique_lock<mutex> lock(mMutexReset);
         mbResetRequested = true;
     }
+    WakeUp();
 
-    while(1)
-    {
-        {
-        unique_lock<mutex> lock2(mMutexReset);
-        if(!mbResetRequested)
-            break;
-        }
-        usleep(5000);
-    }
+    unique_lock<mutex> lock(mMutexWakeUp);
+    while(CheckResetRequested())
+        mcvWakeUp.wait(lock);
 }
 
-void LoopClosing::ResetIfRequested()
+bool LoopClosing::CheckResetRequested()
 {
     unique_lock<mutex> lock(mMutexReset);
-    if(mbResetRequested)
+    return mbResetRequested;
+}
+
+void LoopClosing::ResetIfRequested()
+{
     {
+        unique_lock<mutex> lock(mMutexReset);
+        if(!mbResetRequested)
+            return;
+
         mlpLoopKeyFrameQueue.clear();
         mLastLoopKFid=0;
         mbResetRequested=false;
     }
+    WakeUp();
 }
 
 void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
 {
+    ScopedTimer timer(Stats::GLOBAL_BA);
+
     cout << "Starting Global Bundle Adjustment" << endl;
 
-    int idx =  mnFullBAIdx;
-    Optimizer::GlobalBundleAdjustemnt(mpMap,10,&mbStopGBA,nLoopKF,false);
+    const int nIterations = Optimizer::GlobalBundleAdjustemnt(mpMap,10,&mbStopGBA,nLoopKF,false,&mnGBAIteration);
 
-    // Update all MapPoints and KeyFrames
-    // Local Mapping was active during BA, that means that there might be new keyframes
-    // not included in the Global BA and they are not consistent with the updated map.
-    // We need to propagate the correction through the spanning tree
     {
         unique_lock<mutex> lock(mMutexGBA);
-        if(idx!=mnFullBAIdx)
-            return;
 
-        if(!mbStopGBA)
+        if(mbStopGBA)
+        {
+            // Stopped by a new loop, CorrectLoop merges what was reached so far
+            cout << "Global Bundle Adjustment stopped after " << nIterations << " iterations" << endl;
+            mbPendingGBAMerge = nIterations>0;
+            mnPendingGBALoopKF = nLoopKF;
+        }
+        else
         {
             cout << "Global Bundle Adjustment finished" << endl;
             cout << "Updating map ..." << endl;
             mpLocalMapper->RequestStop();
             // Wait until Local Mapping has effectively stopped
+            mpLocalMapper->WaitUntilStopped();
 
-            while(!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished())
-            {
-                usleep(1000);
-            }
+            MergeGlobalBundleAdjustment(nLoopKF);
 
-            // Get Map Mutex
-            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+            mpLocalMapper->Release();
+
+            cout << "Map updated!" << endl;
+        }
+
+        mbFinishedGBA = true;
+        mbRunningGBA = false;
+    }
+    WakeUp();
+}
 
-            // Correct keyframes starting at map first keyframe
-            list<KeyFrame*> lpKFtoCheck(mpMap->mvpKeyFrameOrigins.begin(),mpMap->mvpKeyFrameOrigins.end());
+void LoopClosing::StopGlobalBundleAdjustment()
+{
+    thread* pThreadGBA;
 
-            while(!lpKFtoCheck.empty())
+    {
+        unique_lock<mutex> lock(mMutexGBA);
+        if(mbRunningGBA)
+            mbStopGBA = true;
+        pThreadGBA = mpThreadGBA;
+        mpThreadGBA = NULL;
+    }
+
+    // The optimizer checks the stop flag between iterations, wait until the estimate is recovered
+    if(pThreadGBA)
+    {
+        if(pThreadGBA->joinable())
+            pThreadGBA->join();
+        delete pThreadGBA;
+    }
+}
+
+void LoopClosing::MergeGlobalBundleAdjustment(unsigned long nLoopKF)
+{
+    // Update all MapPoints and KeyFrames
+    // Local Mapping was active during BA, that means that there might be new keyframes
+    // not included in the Global BA and they are not consistent with the updated map.
+    // We need to propagate the correction through the spanning tree
+    {
+        // Get Map Mutex
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+
+        // Correct keyframes starting at map first keyframe
+        list<KeyFrame*> lpKFtoCheck(mpMap->mvpKeyFrameOrigins.begin(),mpMap->mvpKeyFrameOrigins.end());
+
+        while(!lpKFtoCheck.empty())
+        {
+            KeyFrame* pKF = lpKFtoCheck.front();
+            const set<KeyFrame*> sChilds = pKF->GetChilds();
+            cv::Mat Twc = pKF->GetPoseInverse();
+            for(set<KeyFrame*>::const_iterator sit=sChilds.begin();sit!=sChilds.end();sit++)
             {
-                KeyFrame* pKF = lpKFtoCheck.front();
-                const set<KeyFrame*> sChilds = pKF->GetChilds();
-                cv::Mat Twc = pKF->GetPoseInverse();
-                for(set<KeyFrame*>::const_iterator sit=sChilds.begin();sit!=sChilds.end();sit++)
+                KeyFrame* pChild = *sit;
+                if(pChild->mnBAGlobalForKF!=nLoopKF)
                 {
-                    KeyFrame* pChild = *sit;
-                    if(pChild->mnBAGlobalForKF!=nLoopKF)
-                    {
-                        cv::Mat Tchildc = pChild->GetPose()*Twc;
-                        pChild->mTcwGBA = Tchildc*pKF->mTcwGBA;//*Tcorc*pKF->mTcwGBA;
-                        pChild->mnBAGlobalForKF=nLoopKF;
-
-                    }
-                    lpKFtoCheck.push_back(pChild);
-                }
+                    cv::Mat Tchildc = pChild->GetPose()*Twc;
+                    pChild->mTcwGBA = Tchildc*pKF->mTcwGBA;//*Tcorc*pKF->mTcwGBA;
+                    pChild->mnBAGlobalForKF=nLoopKF;
 
-                pKF->mTcwBefGBA = pKF->GetPose();
-                pKF->SetPose(pKF->mTcwGBA);
-                lpKFtoCheck.pop_front();
+                }
+                lpKFtoCheck.push_back(pChild);
             }
 
-            // Correct MapPoints
-            const vector<MapPoint*> vpMPs = mpMap->GetAllMapPoints();
+            pKF->mTcwBefGBA = pKF->GetPose();
+            pKF->SetPose(pKF->mTcwGBA);
+            lpKFtoCheck.pop_front();
+        }
+    }
 
-            for(size_t i=0; i<vpMPs.size(); i++)
-            {
-                MapPoint* pMP = vpMPs[i];
+    // Correct MapPoints. Local Mapping is stopped, so no point is created or moved meanwhile
+    // and tracking can take the map between chunks.
+    const vector<MapPoint*> vpMPs = mpMap->GetAllMapPoints();
 
-                if(pMP->isBad())
-                    continue;
+    for(size_t i0=0; i0<vpMPs.size(); i0+=GBA_MERGE_CHUNK)
+    {
+        const size_t iend = min(vpMPs.size(),i0+GBA_MERGE_CHUNK);
 
-                if(pMP->mnBAGlobalForKF==nLoopKF)
-                {
-                    // If optimized by Global BA, just update
-                    pMP->SetWorldPos(pMP->mPosGBA);
-                }
-                else
-                {
-                    // Update according to the correction of its reference keyframe
-                    KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+        // Get Map Mutex
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
 
-                    if(pRefKF->mnBAGlobalForKF!=nLoopKF)
-                        continue;
+        for(size_t i=i0; i<iend; i++)
+        {
+            MapPoint* pMP = vpMPs[i];
 
-                    // Map to non-corrected camera
-                    cv::Mat Rcw = pRefKF->mTcwBefGBA.rowRange(0,3).colRange(0,3);
-                    cv::Mat tcw = pRefKF->mTcwBefGBA.rowRange(0,3).col(3);
-                    cv::Mat Xc = Rcw*pMP->GetWorldPos()+tcw;
+            if(pMP->isBad())
+                continue;
 
-                    // Backproject using corrected camera
-                    cv::Mat Twc = pRefKF->GetPoseInverse();
-                    cv::Mat Rwc = Twc.rowRange(0,3).colRange(0,3);
-                    cv::Mat twc = Twc.rowRange(0,3).col(3);
+            if(pMP->mnBAGlobalForKF==nLoopKF)
+            {
+                // If optimized by Global BA, just update
+                pMP->SetWorldPos(pMP->mPosGBA);
+            }
+            else
+            {
+                // Update according to the correction of its reference keyframe
+                KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
 
-                    pMP->SetWorldPos(Rwc*Xc+twc);
-                }
-            }            
+                if(pRefKF->mnBAGlobalForKF!=nLoopKF)
+                    continue;
 
-            mpMap->InformNewBigChange();
+                // Map to non-corrected camera
+                cv::Mat Rcw = pRefKF->mTcwBefGBA.rowRange(0,3).colRange(0,3);
+                cv::Mat tcw = pRefKF->mTcwBefGBA.rowRange(0,3).col(3);
+                cv::Mat Xc = Rcw*pMP->GetWorldPos()+tcw;
 
-            mpLocalMapper->Release();
+                // Backproject using corrected camera
+                cv::Mat Twc = pRefKF->GetPoseInverse();
+                cv::Mat Rwc = Twc.rowRange(0,3).colRange(0,3);
+                cv::Mat twc = Twc.rowRange(0,3).col(3);
 
-            cout << "Map updated!" << endl;
+                pMP->SetWorldPos(Rwc*Xc+twc);
+            }
         }
-
-        mbFinishedGBA = true;
-        mbRunningGBA = false;
     }
+
+    mpMap->InformNewBigChange();
 }
 
 void LoopClosing::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    WakeUp();
 }
 
 bool LoopClosing::CheckFinish()
@@ -764,8 +965,11 @@ bool LoopClosing::CheckFinish()
 
 void LoopClosing::SetFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinished = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinished = true;
+    }
+    WakeUp();
 }
 
 bool LoopClosing::isFinished()
@@ -774,5 +978,25 @@ bool LoopClosing::isFinished()
     return mbFinished;
 }
 
+void LoopClosing::WaitUntilFinished()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    while(!isFinished() || isRunningGBA())
+        mcvWakeUp.wait(lock);
+}
+
+bool LoopClosing::isIdle()
+{
+    unique_lock<mutex> lock(mMutexLoopQueue);
+    return mlpLoopKeyFrameQueue.empty() && !mbProcessingKeyFrame;
+}
+
+void LoopClosing::WaitUntilIdle()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    while(!isIdle() && !isFinished())
+        mcvWakeUp.wait(lock);
+}
+
 
 } //namespace ORB_SLAM
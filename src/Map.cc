@@ -21,14 +21,20 @@
 #include "Map.h"
 
 #include<mutex>
+#include<algorithm>
 
 namespace ORB_SLAM2
 {
 
-Map::Map():mnMaxKFid(0),mnBigChangeIdx(0)
+Map::Map():mnMaxKFid(0),mnBigChangeIdx(0),mnMaxResidentKeyFrames(0),mpTiles(NULL)
 {
 }
 
+Map::~Map()
+{
+    delete mpTiles;
+}
+
 void Map::AddKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexMap);
@@ -40,13 +46,26 @@ void Map::AddKeyFrame(KeyFrame *pKF)
 void Map::AddMapPoint(MapPoint *pMP)
 {
     unique_lock<mutex> lock(mMutexMap);
-    mspMapPoints.insert(pMP);
+    if(pMP->mnMapSlot>=0)
+        return;
+
+    pMP->mnMapSlot = mvpMapPoints.size();
+    mvpMapPoints.push_back(pMP);
 }
 
 void Map::EraseMapPoint(MapPoint *pMP)
 {
     unique_lock<mutex> lock(mMutexMap);
-    mspMapPoints.erase(pMP);
+    const long int slot = pMP->mnMapSlot;
+    if(slot<0 || slot>=(long int)mvpMapPoints.size() || mvpMapPoints[slot]!=pMP)
+        return;
+
+    // Move the last point to the freed slot
+    MapPoint* pLast = mvpMapPoints.back();
+    mvpMapPoints[slot] = pLast;
+    pLast->mnMapSlot = slot;
+    mvpMapPoints.pop_back();
+    pMP->mnMapSlot = -1;
 
     // TODO: This only erase the pointer.
     // Delete the MapPoint
@@ -88,13 +107,13 @@ vector<KeyFrame*> Map::GetAllKeyFrames()
 vector<MapPoint*> Map::GetAllMapPoints()
 {
     unique_lock<mutex> lock(mMutexMap);
-    return vector<MapPoint*>(mspMapPoints.begin(),mspMapPoints.end());
+    return mvpMapPoints;
 }
 
 long unsigned int Map::MapPointsInMap()
 {
     unique_lock<mutex> lock(mMutexMap);
-    return mspMapPoints.size();
+    return mvpMapPoints.size();
 }
 
 long unsigned int Map::KeyFramesInMap()
@@ -117,18 +136,109 @@ long unsigned int Map::GetMaxKFid()
 
 void Map::clear()
 {
-    for(set<MapPoint*>::iterator sit=mspMapPoints.begin(), send=mspMapPoints.end(); sit!=send; sit++)
-        delete *sit;
+    for(vector<MapPoint*>::iterator vit=mvpMapPoints.begin(), vend=mvpMapPoints.end(); vit!=vend; vit++)
+        delete *vit;
 
     for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(), send=mspKeyFrames.end(); sit!=send; sit++)
         delete *sit;
 
-    mspMapPoints.clear();
+    mvpMapPoints.clear();
     mspKeyFrames.clear();
     mspCurrentMapPoints.clear();
     mnMaxKFid = 0;
     mvpReferenceMapPoints.clear();
     mvpKeyFrameOrigins.clear();
+    mvpLocalWindow.clear();
+    if(mpTiles)
+        mpTiles->Clear();
+}
+
+void Map::SetKeyFrameBudget(const int nMaxResident, const string &strDir, const float tileSize, const int nTileRadius)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    mnMaxResidentKeyFrames = nMaxResident;
+    if(!mpTiles)
+        mpTiles = new MapTiles(strDir,tileSize,nTileRadius);
+}
+
+void Map::ReleaseKeyFrameBudget()
+{
+    unique_lock<mutex> lock(mMutexMap);
+    mnMaxResidentKeyFrames = 0;
+    delete mpTiles;
+    mpTiles = NULL;
+}
+
+void Map::SetLocalWindow(const vector<KeyFrame*> &vpLocalKFs, const cv::Mat &Ow)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    if(mnMaxResidentKeyFrames<=0)
+        return;
+    mvpLocalWindow = vpLocalKFs;
+    mCameraCenter = Ow.clone();
+}
+
+void Map::EnforceKeyFrameBudget()
+{
+    int nMaxResident;
+    vector<KeyFrame*> vpKFs;
+    vector<KeyFrame*> vpLocalWindow;
+    cv::Mat Ow;
+    {
+        unique_lock<mutex> lock(mMutexMap);
+        if(mnMaxResidentKeyFrames<=0)
+            return;
+        nMaxResident = mnMaxResidentKeyFrames;
+        vpLocalWindow = mvpLocalWindow;
+        Ow = mCameraCenter.clone();
+        if((int)mspKeyFrames.size()>mnMaxResidentKeyFrames)
+            vpKFs = vector<KeyFrame*>(mspKeyFrames.begin(),mspKeyFrames.end());
+    }
+
+    if(!Ow.empty())
+        mpTiles->SetCameraPosition(Ow);
+
+    // Prefetch the local window, it is where Local Mapping will match next
+    set<KeyFrame*> sLocalWindow;
+    for(size_t i=0; i<vpLocalWindow.size(); i++)
+    {
+        KeyFrame* pKF = vpLocalWindow[i];
+        if(pKF->isBad())
+            continue;
+        sLocalWindow.insert(pKF);
+        if(pKF->isPayloadSpilled())
+        {
+            pKF->PinPayload();
+            pKF->UnpinPayload();
+        }
+    }
+
+    if(vpKFs.empty())
+        return;
+
+    // Eviction order: far from the camera first, then least recently used
+    vector<pair<pair<int,long unsigned int>,KeyFrame*> > vResident;
+    vResident.reserve(vpKFs.size());
+    int nResident = 0;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->isPayloadSpilled())
+            continue;
+        nResident++;
+        if(sLocalWindow.count(pKF))
+            continue;
+        const int nNear = mpTiles->IsNearCamera(pKF->GetCameraCenter()) ? 1 : 0;
+        vResident.push_back(make_pair(make_pair(nNear,pKF->GetLastPayloadAccess()),pKF));
+    }
+
+    // Pinned keyframes are skipped
+    sort(vResident.begin(),vResident.end());
+    for(size_t i=0; i<vResident.size() && nResident>nMaxResident; i++)
+    {
+        if(vResident[i].second->SpillPayload(mpTiles))
+            nResident--;
+    }
 }
 
 void Map::AddCurrentMapPoint(MapPoint *pMP)
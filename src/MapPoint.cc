@@ -22,6 +22,7 @@
 #include "ORBmatcher.h"
 
 #include<mutex>
+#include<cstring>
 
 namespace ORB_SLAM2
 {
@@ -32,11 +33,13 @@ mutex MapPoint::mGlobalMutex;
 MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
     mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
     mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
-    mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),
-    mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap)
+    mnCorrectedReference(0), mnBAGlobalForKF(0), mnMapSlot(-1), mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),
+    mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap),
+    mnGeometrySeq(0), mnDescriptorSeq(0)
 {
     Pos.copyTo(mWorldPos);
     mNormalVector = cv::Mat::zeros(3,1,CV_32F);
+    PublishGeometry();
 
     // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
     unique_lock<mutex> lock(mpMap->mMutexPointCreation);
@@ -46,8 +49,8 @@ MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
 MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF):
     mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0),
     mnBALocalForKF(0), mnFuseCandidateForKF(0),mnLoopPointForKF(0), mnCorrectedByKF(0),
-    mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1),
-    mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap)
+    mnCorrectedReference(0), mnBAGlobalForKF(0), mnMapSlot(-1), mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1),
+    mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap), mnGeometrySeq(0), mnDescriptorSeq(0)
 {
     Pos.copyTo(mWorldPos);
     cv::Mat Ow = pFrame->GetCameraCenter();
@@ -65,6 +68,9 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF
 
     pFrame->mDescriptors.row(idxF).copyTo(mDescriptor);
 
+    PublishGeometry();
+    PublishDescriptor();
+
     // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
     unique_lock<mutex> lock(mpMap->mMutexPointCreation);
     mnId=nNextId++;
@@ -75,18 +81,79 @@ void MapPoint::SetWorldPos(const cv::Mat &Pos)
     unique_lock<mutex> lock2(mGlobalMutex);
     unique_lock<mutex> lock(mMutexPos);
     Pos.copyTo(mWorldPos);
+    PublishGeometry();
 }
 
 cv::Mat MapPoint::GetWorldPos()
 {
-    unique_lock<mutex> lock(mMutexPos);
-    return mWorldPos.clone();
+    float geometry[8];
+    ReadGeometry(geometry);
+    return (cv::Mat_<float>(3,1) << geometry[0], geometry[1], geometry[2]);
 }
 
 cv::Mat MapPoint::GetNormal()
 {
-    unique_lock<mutex> lock(mMutexPos);
-    return mNormalVector.clone();
+    float geometry[8];
+    ReadGeometry(geometry);
+    return (cv::Mat_<float>(3,1) << geometry[3], geometry[4], geometry[5]);
+}
+
+void MapPoint::GetGeometry(float *pos, float *normal, float &minDistance, float &maxDistance)
+{
+    float geometry[8];
+    ReadGeometry(geometry);
+    for(int i=0; i<3; i++)
+    {
+        pos[i] = geometry[i];
+        normal[i] = geometry[3+i];
+    }
+    minDistance = geometry[6];
+    maxDistance = geometry[7];
+}
+
+void MapPoint::PublishGeometry()
+{
+    const unsigned int seq = mnGeometrySeq.load(memory_order_relaxed);
+    mnGeometrySeq.store(seq+1,memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for(int i=0; i<3; i++)
+    {
+        mafGeometry[i].store(mWorldPos.at<float>(i),memory_order_relaxed);
+        mafGeometry[3+i].store(mNormalVector.at<float>(i),memory_order_relaxed);
+    }
+    mafGeometry[6].store(mfMinDistance,memory_order_relaxed);
+    mafGeometry[7].store(mfMaxDistance,memory_order_relaxed);
+
+    mnGeometrySeq.store(seq+2,memory_order_release);
+}
+
+void MapPoint::ReadGeometry(float *geometry)
+{
+    unsigned int seq;
+    do
+    {
+        seq = mnGeometrySeq.load(memory_order_acquire);
+        for(int i=0; i<8; i++)
+            geometry[i] = mafGeometry[i].load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    }
+    while((seq & 1) || seq!=mnGeometrySeq.load(memory_order_relaxed));
+}
+
+void MapPoint::PublishDescriptor()
+{
+    uint32_t words[DESCRIPTOR_WORDS];
+    memcpy(words,mDescriptor.ptr<uint32_t>(),sizeof(words));
+
+    const unsigned int seq = mnDescriptorSeq.load(memory_order_relaxed);
+    mnDescriptorSeq.store(seq+1,memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for(int i=0; i<DESCRIPTOR_WORDS; i++)
+        manDescriptor[i].store(words[i],memory_order_relaxed);
+
+    mnDescriptorSeq.store(seq+2,memory_order_release);
 }
 
 KeyFrame* MapPoint::GetReferenceKeyFrame()
@@ -142,6 +209,13 @@ map<KeyFrame*, size_t> MapPoint::GetObservations()
     return mObservations;
 }
 
+void MapPoint::GetObservingKeyFrames(vector<KeyFrame*> &vpKFs)
+{
+    unique_lock<mutex> lock(mMutexFeatures);
+    for(map<KeyFrame*,size_t>::const_iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
+        vpKFs.push_back(mit->first);
+}
+
 int MapPoint::Observations()
 {
     unique_lock<mutex> lock(mMutexFeatures);
@@ -164,6 +238,8 @@ void MapPoint::SetBadFlag()
         pKF->EraseMapPointMatch(mit->second);
     }
 
+    ClearDescriptorCache();
+
     mpMap->EraseMapPoint(this);
 }
 
@@ -211,39 +287,38 @@ void MapPoint::Replace(MapPoint* pMP)
     pMP->IncreaseVisible(nvisible);
     pMP->ComputeDistinctiveDescriptors();
 
+    ClearDescriptorCache();
+
     mpMap->EraseMapPoint(this);
 }
 
 bool MapPoint::isBad()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
-    unique_lock<mutex> lock2(mMutexPos);
-    return mbBad;
+    return mbBad.load();
 }
 
 void MapPoint::IncreaseVisible(int n)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
     mnVisible+=n;
 }
 
 void MapPoint::IncreaseFound(int n)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
     mnFound+=n;
 }
 
 float MapPoint::GetFoundRatio()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
-    return static_cast<float>(mnFound)/mnVisible;
+    return static_cast<float>(mnFound.load())/mnVisible.load();
 }
 
 void MapPoint::ComputeDistinctiveDescriptors()
 {
-    // Retrieve all observed descriptors
-    vector<cv::Mat> vDescriptors;
+    // The pairwise distances are cached between calls, only those of new observations are computed.
+    // The cache is dropped when the point leaves the local map of the tracking.
+    unique_lock<mutex> lockDescriptors(mMutexDescriptors);
 
+    // Retrieve all observed descriptors
     map<KeyFrame*,size_t> observations;
 
     {
@@ -256,42 +331,79 @@ void MapPoint::ComputeDistinctiveDescriptors()
     if(observations.empty())
         return;
 
-    vDescriptors.reserve(observations.size());
+    vector<pair<KeyFrame*,size_t> > vObs;
+    vObs.reserve(observations.size());
 
     for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
 
         if(!pKF->isBad())
-            vDescriptors.push_back(pKF->mDescriptors.row(mit->second));
+            vObs.push_back(*mit);
     }
 
-    if(vDescriptors.empty())
+    if(vObs.empty())
         return;
 
-    // Compute distances between them
-    const size_t N = vDescriptors.size();
+    const size_t N = vObs.size();
+
+    // Position of each observation in the cache, -1 if new
+    vector<int> vCached(N,-1);
+    {
+        size_t j=0;
+        for(size_t i=0; i<N; i++)
+        {
+            // Both lists are sorted by keyframe
+            while(j<mvDescriptorObs.size() && mvDescriptorObs[j].pKF<vObs[i].first)
+                j++;
+            if(j<mvDescriptorObs.size() && mvDescriptorObs[j].pKF==vObs[i].first && mvDescriptorObs[j].idx==vObs[i].second)
+                vCached[i]=j;
+        }
+    }
+
+    vector<DescriptorObservation> vNewObs(N);
+    for(size_t i=0; i<N; i++)
+    {
+        if(vCached[i]>=0)
+        {
+            vNewObs[i] = mvDescriptorObs[vCached[i]];
+            continue;
+        }
+
+        vNewObs[i].pKF = vObs[i].first;
+        vNewObs[i].idx = vObs[i].second;
+        KeyFramePayloadPin pin(vObs[i].first);
+        memcpy(vNewObs[i].descriptor,vObs[i].first->mDescriptors.ptr<uint32_t>(vObs[i].second),sizeof(vNewObs[i].descriptor));
+    }
 
-    float Distances[N][N];
+    // Compute distances between them
+    vector<unsigned short> vDistances(N*(N-1)/2);
     for(size_t i=0;i<N;i++)
     {
-        Distances[i][i]=0;
+        cv::Mat di(1,32,CV_8U,vNewObs[i].descriptor);
         for(size_t j=i+1;j<N;j++)
         {
-            int distij = ORBmatcher::DescriptorDistance(vDescriptors[i],vDescriptors[j]);
-            Distances[i][j]=distij;
-            Distances[j][i]=distij;
+            if(vCached[i]>=0 && vCached[j]>=0)
+                vDistances[PairIndex(i,j,N)] = mvDescriptorDistances[PairIndex(vCached[i],vCached[j],mvDescriptorObs.size())];
+            else
+                vDistances[PairIndex(i,j,N)] = ORBmatcher::DescriptorDistance(di,cv::Mat(1,32,CV_8U,vNewObs[j].descriptor));
         }
     }
 
+    mvDescriptorObs.swap(vNewObs);
+    mvDescriptorDistances.swap(vDistances);
+
     // Take the descriptor with least median distance to the rest
     int BestMedian = INT_MAX;
     int BestIdx = 0;
+    vector<int> vDists(N);
     for(size_t i=0;i<N;i++)
     {
-        vector<int> vDists(Distances[i],Distances[i]+N);
-        sort(vDists.begin(),vDists.end());
-        int median = vDists[0.5*(N-1)];
+        for(size_t j=0;j<N;j++)
+            vDists[j] = i==j ? 0 : mvDescriptorDistances[PairIndex(min(i,j),max(i,j),N)];
+        vector<int>::iterator itMedian = vDists.begin()+static_cast<size_t>(0.5*(N-1));
+        nth_element(vDists.begin(),itMedian,vDists.end());
+        int median = *itMedian;
 
         if(median<BestMedian)
         {
@@ -302,14 +414,38 @@ void MapPoint::ComputeDistinctiveDescriptors()
 
     {
         unique_lock<mutex> lock(mMutexFeatures);
-        mDescriptor = vDescriptors[BestIdx].clone();
+        mDescriptor = cv::Mat(1,32,CV_8U,mvDescriptorObs[BestIdx].descriptor).clone();
+        PublishDescriptor();
     }
 }
 
+void MapPoint::ClearDescriptorCache()
+{
+    unique_lock<mutex> lock(mMutexDescriptors);
+    vector<DescriptorObservation>().swap(mvDescriptorObs);
+    vector<unsigned short>().swap(mvDescriptorDistances);
+}
+
 cv::Mat MapPoint::GetDescriptor()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
-    return mDescriptor.clone();
+    uint32_t words[DESCRIPTOR_WORDS];
+    unsigned int seq;
+    do
+    {
+        seq = mnDescriptorSeq.load(memory_order_acquire);
+        for(int i=0; i<DESCRIPTOR_WORDS; i++)
+            words[i] = manDescriptor[i].load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    }
+    while((seq & 1) || seq!=mnDescriptorSeq.load(memory_order_relaxed));
+
+    // Not computed yet
+    if(seq==0)
+        return cv::Mat();
+
+    cv::Mat descriptor(1,sizeof(words),CV_8U);
+    memcpy(descriptor.data,words,sizeof(words));
+    return descriptor;
 }
 
 int MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
@@ -367,28 +503,23 @@ void MapPoint::UpdateNormalAndDepth()
         mfMaxDistance = dist*levelScaleFactor;
         mfMinDistance = mfMaxDistance/pRefKF->mvScaleFactors[nLevels-1];
         mNormalVector = normal/n;
+        PublishGeometry();
     }
 }
 
 float MapPoint::GetMinDistanceInvariance()
 {
-    unique_lock<mutex> lock(mMutexPos);
-    return 0.8f*mfMinDistance;
+    return 0.8f*mafGeometry[6].load(memory_order_relaxed);
 }
 
 float MapPoint::GetMaxDistanceInvariance()
 {
-    unique_lock<mutex> lock(mMutexPos);
-    return 1.2f*mfMaxDistance;
+    return 1.2f*mafGeometry[7].load(memory_order_relaxed);
 }
 
 int MapPoint::PredictScale(const float &currentDist, KeyFrame* pKF)
 {
-    float ratio;
-    {
-        unique_lock<mutex> lock(mMutexPos);
-        ratio = mfMaxDistance/currentDist;
-    }
+    const float ratio = mafGeometry[7].load(memory_order_relaxed)/currentDist;
 
     int nScale = ceil(log(ratio)/pKF->mfLogScaleFactor);
     if(nScale<0)
@@ -401,11 +532,7 @@ int MapPoint::PredictScale(const float &currentDist, KeyFrame* pKF)
 
 int MapPoint::PredictScale(const float &currentDist, Frame* pF)
 {
-    float ratio;
-    {
-        unique_lock<mutex> lock(mMutexPos);
-        ratio = mfMaxDistance/currentDist;
-    }
+    const float ratio = mafGeometry[7].load(memory_order_relaxed)/currentDist;
 
     int nScale = ceil(log(ratio)/pF->mfLogScaleFactor);
     if(nScale<0)
@@ -0,0 +1,200 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapTiles.h"
+
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+MapTiles::MapTiles(const string &strDir, const float tileSize, const int nRadius):
+    mStrDir(strDir), mTileSize(tileSize), mnRadius(nRadius), mCamX(0), mCamY(0), mCamZ(0)
+{
+}
+
+MapTiles::~MapTiles()
+{
+    Clear();
+}
+
+void MapTiles::GetTileCoords(const cv::Mat &Pw, int &x, int &y, int &z)
+{
+    if(mTileSize<=0)
+    {
+        x = y = z = 0;
+        return;
+    }
+
+    x = floor(Pw.at<float>(0)/mTileSize);
+    y = floor(Pw.at<float>(1)/mTileSize);
+    z = floor(Pw.at<float>(2)/mTileSize);
+}
+
+bool MapTiles::IsNear(const int x, const int y, const int z)
+{
+    return abs(x-mCamX)<=mnRadius && abs(y-mCamY)<=mnRadius && abs(z-mCamZ)<=mnRadius;
+}
+
+bool MapTiles::Write(const cv::Mat &Pw, const string &data, Record &record)
+{
+    int x, y, z;
+    GetTileCoords(Pw,x,y,z);
+
+    unique_lock<mutex> lock(mMutexTiles);
+
+    vector<int> key(3);
+    key[0]=x; key[1]=y; key[2]=z;
+    map<vector<int>,int>::iterator mit = mTileIndices.find(key);
+    int nTile;
+    if(mit==mTileIndices.end())
+    {
+        Tile tile;
+        tile.x=x; tile.y=y; tile.z=z;
+        stringstream ss;
+        ss << mStrDir << "/Tile_" << x << "_" << y << "_" << z << ".bin";
+        tile.strFile = ss.str();
+        tile.fd = open(tile.strFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(tile.fd<0)
+        {
+            cerr << "Failed to create map tile at: " << tile.strFile << endl;
+            return false;
+        }
+        tile.nSize = 0;
+        tile.pMapped = NULL;
+        tile.nMapped = 0;
+
+        nTile = mvTiles.size();
+        mvTiles.push_back(tile);
+        mTileIndices[key] = nTile;
+    }
+    else
+        nTile = mit->second;
+
+    Tile &tile = mvTiles[nTile];
+
+    size_t nWritten = 0;
+    while(nWritten<data.size())
+    {
+        const ssize_t n = pwrite(tile.fd, data.data()+nWritten, data.size()-nWritten, tile.nSize+nWritten);
+        if(n<=0)
+        {
+            cerr << "Failed to write map tile at: " << tile.strFile << endl;
+            return false;
+        }
+        nWritten += n;
+    }
+
+    record.nTile = nTile;
+    record.offset = tile.nSize;
+    record.size = data.size();
+    tile.nSize += data.size();
+
+    return true;
+}
+
+bool MapTiles::Read(const Record &record, string &data)
+{
+    unique_lock<mutex> lock(mMutexTiles);
+
+    Tile &tile = mvTiles[record.nTile];
+
+    // Map the whole file, again if it has grown past the current mapping
+    if(record.offset+record.size>tile.nMapped)
+    {
+        Unmap(tile);
+        void* p = mmap(NULL, tile.nSize, PROT_READ, MAP_SHARED, tile.fd, 0);
+        if(p==MAP_FAILED)
+        {
+            cerr << "Failed to map tile: " << tile.strFile << endl;
+            return false;
+        }
+        tile.pMapped = static_cast<char*>(p);
+        tile.nMapped = tile.nSize;
+    }
+
+    data.assign(tile.pMapped+record.offset, tile.pMapped+record.offset+record.size);
+
+    // Keep the mapping only if the tile is around the camera
+    if(!IsNear(tile.x,tile.y,tile.z))
+        Unmap(tile);
+
+    return true;
+}
+
+void MapTiles::SetCameraPosition(const cv::Mat &Ow)
+{
+    int x, y, z;
+    GetTileCoords(Ow,x,y,z);
+
+    unique_lock<mutex> lock(mMutexTiles);
+    if(x==mCamX && y==mCamY && z==mCamZ)
+        return;
+
+    mCamX=x; mCamY=y; mCamZ=z;
+
+    for(size_t i=0; i<mvTiles.size(); i++)
+    {
+        if(!IsNear(mvTiles[i].x,mvTiles[i].y,mvTiles[i].z))
+            Unmap(mvTiles[i]);
+    }
+}
+
+bool MapTiles::IsNearCamera(const cv::Mat &Pw)
+{
+    int x, y, z;
+    GetTileCoords(Pw,x,y,z);
+
+    unique_lock<mutex> lock(mMutexTiles);
+    return IsNear(x,y,z);
+}
+
+void MapTiles::Unmap(Tile &tile)
+{
+    if(tile.pMapped)
+        munmap(tile.pMapped, tile.nMapped);
+    tile.pMapped = NULL;
+    tile.nMapped = 0;
+}
+
+void MapTiles::Clear()
+{
+    unique_lock<mutex> lock(mMutexTiles);
+    for(size_t i=0; i<mvTiles.size(); i++)
+    {
+        Unmap(mvTiles[i]);
+        close(mvTiles[i].fd);
+        unlink(mvTiles[i].strFile.c_str());
+    }
+    mvTiles.clear();
+    mTileIndices.clear();
+}
+
+} //namespace ORB_SLAM
@@ -158,6 +158,8 @@ bool ORBmatcher::CheckDistEpipolarLine(const cv::KeyPoint &kp1,const cv::KeyPoin
 
 int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPointMatches)
 {
+    KeyFramePayloadPin pin(pKF);
+
     const vector<MapPoint*> vpMapPointsKF = pKF->GetMapPointMatches();
 
     vpMapPointMatches = vector<MapPoint*>(F.N,static_cast<MapPoint*>(NULL));
@@ -289,6 +291,8 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
 
 int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapPoint*> &vpPoints, vector<MapPoint*> &vpMatched, int th)
 {
+    KeyFramePayloadPin pin(pKF);
+
     // Get Calibration Parameters for later projection
     const float &fx = pKF->fx;
     const float &fy = pKF->fy;
@@ -521,6 +525,9 @@ int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f
 
 int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches12)
 {
+    KeyFramePayloadPin pin1(pKF1);
+    KeyFramePayloadPin pin2(pKF2);
+
     const vector<cv::KeyPoint> &vKeysUn1 = pKF1->mvKeysUn;
     const DBoW2::FeatureVector &vFeatVec1 = pKF1->mFeatVec;
     const vector<MapPoint*> vpMapPoints1 = pKF1->GetMapPointMatches();
@@ -657,6 +664,9 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
 int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F12,
                                        vector<pair<size_t, size_t> > &vMatchedPairs, const bool bOnlyStereo)
 {    
+    KeyFramePayloadPin pin1(pKF1);
+    KeyFramePayloadPin pin2(pKF2);
+
     const DBoW2::FeatureVector &vFeatVec1 = pKF1->mFeatVec;
     const DBoW2::FeatureVector &vFeatVec2 = pKF2->mFeatVec;
 
@@ -824,15 +834,10 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
 
 int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const float th)
 {
+    KeyFramePayloadPin pin(pKF);
+
     cv::Mat Rcw = pKF->GetRotation();
     cv::Mat tcw = pKF->GetTranslation();
-
-    const float &fx = pKF->fx;
-    const float &fy = pKF->fy;
-    const float &cx = pKF->cx;
-    const float &cy = pKF->cy;
-    const float &bf = pKF->mbf;
-
     cv::Mat Ow = pKF->GetCameraCenter();
 
     int nFused=0;
@@ -849,133 +854,224 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
         if(pMP->isBad() || pMP->IsInKeyFrame(pKF))
             continue;
 
-        cv::Mat p3Dw = pMP->GetWorldPos();
-        cv::Mat p3Dc = Rcw*p3Dw + tcw;
+        const int bestIdx = SearchFuse(pKF,Rcw,tcw,Ow,pMP,th);
 
-        // Depth must be positive
-        if(p3Dc.at<float>(2)<0.0f)
-            continue;
+        if(bestIdx>=0)
+        {
+            FuseMapPoint(pKF,pMP,bestIdx);
+            nFused++;
+        }
+    }
 
-        const float invz = 1/p3Dc.at<float>(2);
-        const float x = p3Dc.at<float>(0)*invz;
-        const float y = p3Dc.at<float>(1)*invz;
+    return nFused;
+}
 
-        const float u = fx*x+cx;
-        const float v = fy*y+cy;
+void ORBmatcher::SearchFuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const size_t begin, const size_t end,
+                            vector<int> &vnFuseIdx, const float th)
+{
+    KeyFramePayloadPin pin(pKF);
 
-        // Point must be inside the image
-        if(!pKF->IsInImage(u,v))
-            continue;
+    cv::Mat Rcw = pKF->GetRotation();
+    cv::Mat tcw = pKF->GetTranslation();
+    cv::Mat Ow = pKF->GetCameraCenter();
 
-        const float ur = u-bf*invz;
+    for(size_t i=begin; i<end; i++)
+    {
+        vnFuseIdx[i] = -1;
 
-        const float maxDistance = pMP->GetMaxDistanceInvariance();
-        const float minDistance = pMP->GetMinDistanceInvariance();
-        cv::Mat PO = p3Dw-Ow;
-        const float dist3D = cv::norm(PO);
+        MapPoint* pMP = vpMapPoints[i];
 
-        // Depth must be inside the scale pyramid of the image
-        if(dist3D<minDistance || dist3D>maxDistance )
+        if(!pMP)
             continue;
 
-        // Viewing angle must be less than 60 deg
-        cv::Mat Pn = pMP->GetNormal();
-
-        if(PO.dot(Pn)<0.5*dist3D)
+        if(pMP->isBad() || pMP->IsInKeyFrame(pKF))
             continue;
 
-        int nPredictedLevel = pMP->PredictScale(dist3D,pKF);
+        vnFuseIdx[i] = SearchFuse(pKF,Rcw,tcw,Ow,pMP,th);
+    }
+}
 
-        // Search in a radius
-        const float radius = th*pKF->mvScaleFactors[nPredictedLevel];
+int ORBmatcher::ApplyFuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const vector<int> &vnFuseIdx,
+                          set<MapPoint*> &spChanged, const float th)
+{
+    KeyFramePayloadPin pin(pKF);
 
-        const vector<size_t> vIndices = pKF->GetFeaturesInArea(u,v,radius);
+    cv::Mat Rcw = pKF->GetRotation();
+    cv::Mat tcw = pKF->GetTranslation();
+    cv::Mat Ow = pKF->GetCameraCenter();
 
-        if(vIndices.empty())
-            continue;
+    int nFused=0;
 
-        // Match to the most similar keypoint in the radius
+    const int nMPs = vpMapPoints.size();
 
-        const cv::Mat dMP = pMP->GetDescriptor();
+    for(int i=0; i<nMPs; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
 
-        int bestDist = 256;
-        int bestIdx = -1;
-        for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
-        {
-            const size_t idx = *vit;
+        if(!pMP)
+            continue;
 
-            const cv::KeyPoint &kp = pKF->mvKeysUn[idx];
+        if(pMP->isBad() || pMP->IsInKeyFrame(pKF))
+            continue;
 
-            const int &kpLevel= kp.octave;
+        // The descriptor of a point that survived a replacement has been recomputed, search it again
+        const int bestIdx = spChanged.count(pMP) ? SearchFuse(pKF,Rcw,tcw,Ow,pMP,th) : vnFuseIdx[i];
 
-            if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
-                continue;
+        if(bestIdx>=0)
+        {
+            MapPoint* pMPSurvivor = FuseMapPoint(pKF,pMP,bestIdx);
+            if(pMPSurvivor)
+                spChanged.insert(pMPSurvivor);
+            nFused++;
+        }
+    }
+
+    return nFused;
+}
 
-            if(pKF->mvuRight[idx]>=0)
+MapPoint* ORBmatcher::FuseMapPoint(KeyFrame *pKF, MapPoint *pMP, const int idx)
+{
+    // If there is already a MapPoint replace otherwise add new measurement
+    MapPoint* pMPinKF = pKF->GetMapPoint(idx);
+    if(pMPinKF)
+    {
+        if(!pMPinKF->isBad())
+        {
+            if(pMPinKF->Observations()>pMP->Observations())
             {
-                // Check reprojection error in stereo
-                const float &kpx = kp.pt.x;
-                const float &kpy = kp.pt.y;
-                const float &kpr = pKF->mvuRight[idx];
-                const float ex = u-kpx;
-                const float ey = v-kpy;
-                const float er = ur-kpr;
-                const float e2 = ex*ex+ey*ey+er*er;
-
-                if(e2*pKF->mvInvLevelSigma2[kpLevel]>7.8)
-                    continue;
+                pMP->Replace(pMPinKF);
+                return pMPinKF;
             }
             else
             {
-                const float &kpx = kp.pt.x;
-                const float &kpy = kp.pt.y;
-                const float ex = u-kpx;
-                const float ey = v-kpy;
-                const float e2 = ex*ex+ey*ey;
-
-                if(e2*pKF->mvInvLevelSigma2[kpLevel]>5.99)
-                    continue;
+                pMPinKF->Replace(pMP);
+                return pMP;
             }
+        }
+    }
+    else
+    {
+        pMP->AddObservation(pKF,idx);
+        pKF->AddMapPoint(pMP,idx);
+    }
 
-            const cv::Mat &dKF = pKF->mDescriptors.row(idx);
+    return static_cast<MapPoint*>(NULL);
+}
 
-            const int dist = DescriptorDistance(dMP,dKF);
+int ORBmatcher::SearchFuse(KeyFrame *pKF, const cv::Mat &Rcw, const cv::Mat &tcw, const cv::Mat &Ow, MapPoint *pMP, const float th)
+{
+    const float &fx = pKF->fx;
+    const float &fy = pKF->fy;
+    const float &cx = pKF->cx;
+    const float &cy = pKF->cy;
+    const float &bf = pKF->mbf;
 
-            if(dist<bestDist)
-            {
-                bestDist = dist;
-                bestIdx = idx;
-            }
+    cv::Mat p3Dw = pMP->GetWorldPos();
+    cv::Mat p3Dc = Rcw*p3Dw + tcw;
+
+    // Depth must be positive
+    if(p3Dc.at<float>(2)<0.0f)
+        return -1;
+
+    const float invz = 1/p3Dc.at<float>(2);
+    const float x = p3Dc.at<float>(0)*invz;
+    const float y = p3Dc.at<float>(1)*invz;
+
+    const float u = fx*x+cx;
+    const float v = fy*y+cy;
+
+    // Point must be inside the image
+    if(!pKF->IsInImage(u,v))
+        return -1;
+
+    const float ur = u-bf*invz;
+
+    const float maxDistance = pMP->GetMaxDistanceInvariance();
+    const float minDistance = pMP->GetMinDistanceInvariance();
+    cv::Mat PO = p3Dw-Ow;
+    const float dist3D = cv::norm(PO);
+
+    // Depth must be inside the scale pyramid of the image
+    if(dist3D<minDistance || dist3D>maxDistance )
+        return -1;
+
+    // Viewing angle must be less than 60 deg
+    cv::Mat Pn = pMP->GetNormal();
+
+    if(PO.dot(Pn)<0.5*dist3D)
+        return -1;
+
+    int nPredictedLevel = pMP->PredictScale(dist3D,pKF);
+
+    // Search in a radius
+    const float radius = th*pKF->mvScaleFactors[nPredictedLevel];
+
+    const vector<size_t> vIndices = pKF->GetFeaturesInArea(u,v,radius);
+
+    if(vIndices.empty())
+        return -1;
+
+    // Match to the most similar keypoint in the radius
+
+    const cv::Mat dMP = pMP->GetDescriptor();
+
+    int bestDist = 256;
+    int bestIdx = -1;
+    for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
+    {
+        const size_t idx = *vit;
+
+        const cv::KeyPoint &kp = pKF->mvKeysUn[idx];
+
+        const int &kpLevel= kp.octave;
+
+        if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
+            continue;
+
+        if(pKF->mvuRight[idx]>=0)
+        {
+            // Check reprojection error in stereo
+            const float &kpx = kp.pt.x;
+            const float &kpy = kp.pt.y;
+            const float &kpr = pKF->mvuRight[idx];
+            const float ex = u-kpx;
+            const float ey = v-kpy;
+            const float er = ur-kpr;
+            const float e2 = ex*ex+ey*ey+er*er;
+
+            if(e2*pKF->mvInvLevelSigma2[kpLevel]>7.8)
+                continue;
         }
+        else
+        {
+            const float &kpx = kp.pt.x;
+            const float &kpy = kp.pt.y;
+            const float ex = u-kpx;
+            const float ey = v-kpy;
+            const float e2 = ex*ex+ey*ey;
 
-        // If there is already a MapPoint replace otherwise add new measurement
-        if(bestDist<=TH_LOW)
+            if(e2*pKF->mvInvLevelSigma2[kpLevel]>5.99)
+                continue;
+        }
+
+        const cv::Mat &dKF = pKF->mDescriptors.row(idx);
+
+        const int dist = DescriptorDistance(dMP,dKF);
+
+        if(dist<bestDist)
         {
-            MapPoint* pMPinKF = pKF->GetMapPoint(bestIdx);
-            if(pMPinKF)
-            {
-                if(!pMPinKF->isBad())
-                {
-                    if(pMPinKF->Observations()>pMP->Observations())
-                        pMP->Replace(pMPinKF);
-                    else
-                        pMPinKF->Replace(pMP);
-                }
-            }
-            else
-            {
-                pMP->AddObservation(pKF,bestIdx);
-                pKF->AddMapPoint(pMP,bestIdx);
-            }
-            nFused++;
+            bestDist = dist;
+            bestIdx = idx;
         }
     }
 
-    return nFused;
+    return bestDist<=TH_LOW ? bestIdx : -1;
 }
 
 int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoints, float th, vector<MapPoint *> &vpReplacePoint)
 {
+    KeyFramePayloadPin pin(pKF);
+
     // Get Calibration Parameters for later projection
     const float &fx = pKF->fx;
     const float &fy = pKF->fy;
@@ -1102,6 +1198,9 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
 int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &vpMatches12,
                              const float &s12, const cv::Mat &R12, const cv::Mat &t12, const float th)
 {
+    KeyFramePayloadPin pin1(pKF1);
+    KeyFramePayloadPin pin2(pKF2);
+
     const float &fx = pKF1->fx;
     const float &fy = pKF1->fy;
     const float &cx = pKF1->cx;
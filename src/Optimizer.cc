@@ -26,12 +26,14 @@
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_eigen.h"
 #include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
 #include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
+#include "Thirdparty/g2o/g2o/core/hyper_graph_action.h"
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_dense.h"
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
 #include<Eigen/StdVector>
 
 #include "Converter.h"
+#include "Stats.h"
 
 #include<mutex>
 
@@ -39,16 +41,37 @@ namespace ORB_SLAM2
 {
 
 
-void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+// Publishes the number of iterations done by the optimizer
+class IterationCounterAction : public g2o::HyperGraphAction
+{
+public:
+    IterationCounterAction(std::atomic<int> *pnIteration) : mpnIteration(pnIteration) {}
+
+    virtual g2o::HyperGraphAction* operator()(const g2o::HyperGraph*, Parameters* parameters)
+    {
+        g2o::HyperGraphAction::ParametersIteration* params = dynamic_cast<g2o::HyperGraphAction::ParametersIteration*>(parameters);
+        if(params)
+            *mpnIteration = params->iteration+1;
+        return this;
+    }
+
+private:
+    std::atomic<int> *mpnIteration;
+};
+
+
+int Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust,
+                                      std::atomic<int> *pnIteration)
 {
     vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
     vector<MapPoint*> vpMP = pMap->GetAllMapPoints();
-    BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust);
+    return BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust, pnIteration);
 }
 
 
-void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
-                                 int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+int Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
+                                int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust,
+                                std::atomic<int> *pnIteration)
 {
     vector<bool> vbNotIncludedMP;
     vbNotIncludedMP.resize(vpMP.size());
@@ -66,6 +89,13 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
     if(pbStopFlag)
         optimizer.setForceStopFlag(pbStopFlag);
 
+    IterationCounterAction iterationCounter(pnIteration);
+    if(pnIteration)
+    {
+        *pnIteration = 0;
+        optimizer.addPostIterationAction(&iterationCounter);
+    }
+
     long unsigned int maxKFid = 0;
 
     // Set KeyFrame vertices
@@ -186,7 +216,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
 
     // Optimize!
     optimizer.initializeOptimization();
-    optimizer.optimize(nIterations);
+    const int nDone = max(optimizer.optimize(nIterations),0);
 
     // Recover optimized data
 
@@ -235,10 +265,13 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         }
     }
 
+    return nDone;
 }
 
 int Optimizer::PoseOptimization(Frame *pFrame)
 {
+    ScopedTimer timer(Stats::POSE_OPTIMIZATION);
+
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
 
@@ -456,6 +489,8 @@ int Optimizer::PoseOptimization(Frame *pFrame)
 
 void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap)
 {    
+    ScopedTimer timer(Stats::LOCAL_BA);
+
     // Local KeyFrames: First Breath Search from Current Keyframe
     list<KeyFrame*> lLocalKeyFrames;
 
@@ -785,7 +820,10 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
 void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
-                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale)
+                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale,
+                                       vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vScw,
+                                       vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vCorrectedSiw,
+                                       vector<bool> &vbOptimized)
 {
     // Setup optimizer
     g2o::SparseOptimizer optimizer;
@@ -798,14 +836,15 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     solver->setUserLambdaInit(1e-16);
     optimizer.setAlgorithm(solver);
 
+    // Local Mapping may be running: keyframes inserted or culled meanwhile are left out of the graph
     const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
-    const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
 
     const unsigned int nMaxKFid = pMap->GetMaxKFid();
 
-    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vScw(nMaxKFid+1);
-    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vCorrectedSwc(nMaxKFid+1);
-    vector<g2o::VertexSim3Expmap*> vpVertices(nMaxKFid+1);
+    vScw.assign(nMaxKFid+1,g2o::Sim3());
+    vCorrectedSiw.assign(nMaxKFid+1,g2o::Sim3());
+    vbOptimized.assign(nMaxKFid+1,false);
+    vector<g2o::VertexSim3Expmap*> vpVertices(nMaxKFid+1,static_cast<g2o::VertexSim3Expmap*>(NULL));
 
     const int minFeat = 100;
 
@@ -828,8 +867,9 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         }
         else
         {
-            Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKF->GetRotation());
-            Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKF->GetTranslation());
+            const cv::Mat Tiw = pKF->GetPose();
+            Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(Tiw.rowRange(0,3).colRange(0,3));
+            Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(Tiw.rowRange(0,3).col(3));
             g2o::Sim3 Siw(Rcw,tcw,1.0);
             vScw[nIDi] = Siw;
             VSim3->setEstimate(Siw);
@@ -864,6 +904,8 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         for(set<KeyFrame*>::const_iterator sit=spConnections.begin(), send=spConnections.end(); sit!=send; sit++)
         {
             const long unsigned int nIDj = (*sit)->mnId;
+            if(nIDj>nMaxKFid || !vpVertices[nIDj] || !vpVertices[nIDi])
+                continue;
             if((nIDi!=pCurKF->mnId || nIDj!=pLoopKF->mnId) && pKF->GetWeight(*sit)<minFeat)
                 continue;
 
@@ -890,6 +932,9 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
 
         const int nIDi = pKF->mnId;
 
+        if(!vpVertices[nIDi])
+            continue;
+
         g2o::Sim3 Swi;
 
         LoopClosing::KeyFrameAndPose::const_iterator iti = NonCorrectedSim3.find(pKF);
@@ -902,7 +947,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         KeyFrame* pParentKF = pKF->GetParent();
 
         // Spanning tree edge
-        if(pParentKF)
+        if(pParentKF && pParentKF->mnId<=nMaxKFid && vpVertices[pParentKF->mnId])
         {
             int nIDj = pParentKF->mnId;
 
@@ -931,7 +976,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         for(set<KeyFrame*>::const_iterator sit=sLoopEdges.begin(), send=sLoopEdges.end(); sit!=send; sit++)
         {
             KeyFrame* pLKF = *sit;
-            if(pLKF->mnId<pKF->mnId)
+            if(pLKF->mnId<pKF->mnId && vpVertices[pLKF->mnId])
             {
                 g2o::Sim3 Slw;
 
@@ -959,7 +1004,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
             KeyFrame* pKFn = *vit;
             if(pKFn && pKFn!=pParentKF && !pKF->hasChild(pKFn) && !sLoopEdges.count(pKFn))
             {
-                if(!pKFn->isBad() && pKFn->mnId<pKF->mnId)
+                if(!pKFn->isBad() && pKFn->mnId<pKF->mnId && vpVertices[pKFn->mnId])
                 {
                     if(sInsertedEdges.count(make_pair(min(pKF->mnId,pKFn->mnId),max(pKF->mnId,pKFn->mnId))))
                         continue;
@@ -990,60 +1035,16 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     optimizer.initializeOptimization();
     optimizer.optimize(20);
 
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
-
-    // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
+    // Recover the optimized poses, the map is corrected by the caller
     for(size_t i=0;i<vpKFs.size();i++)
     {
-        KeyFrame* pKFi = vpKFs[i];
-
-        const int nIDi = pKFi->mnId;
-
-        g2o::VertexSim3Expmap* VSim3 = static_cast<g2o::VertexSim3Expmap*>(optimizer.vertex(nIDi));
-        g2o::Sim3 CorrectedSiw =  VSim3->estimate();
-        vCorrectedSwc[nIDi]=CorrectedSiw.inverse();
-        Eigen::Matrix3d eigR = CorrectedSiw.rotation().toRotationMatrix();
-        Eigen::Vector3d eigt = CorrectedSiw.translation();
-        double s = CorrectedSiw.scale();
+        const int nIDi = vpKFs[i]->mnId;
 
-        eigt *=(1./s); //[R t/s;0 1]
-
-        cv::Mat Tiw = Converter::toCvSE3(eigR,eigt);
-
-        pKFi->SetPose(Tiw);
-    }
-
-    // Correct points. Transform to "non-optimized" reference keyframe pose and transform back with optimized pose
-    for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
-    {
-        MapPoint* pMP = vpMPs[i];
-
-        if(pMP->isBad())
+        if(!vpVertices[nIDi])
             continue;
 
-        int nIDr;
-        if(pMP->mnCorrectedByKF==pCurKF->mnId)
-        {
-            nIDr = pMP->mnCorrectedReference;
-        }
-        else
-        {
-            KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
-            nIDr = pRefKF->mnId;
-        }
-
-
-        g2o::Sim3 Srw = vScw[nIDr];
-        g2o::Sim3 correctedSwr = vCorrectedSwc[nIDr];
-
-        cv::Mat P3Dw = pMP->GetWorldPos();
-        Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
-        Eigen::Matrix<double,3,1> eigCorrectedP3Dw = correctedSwr.map(Srw.map(eigP3Dw));
-
-        cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
-        pMP->SetWorldPos(cvCorrectedP3Dw);
-
-        pMP->UpdateNormalAndDepth();
+        vCorrectedSiw[nIDi] = vpVertices[nIDi]->estimate();
+        vbOptimized[nIDi] = true;
     }
 }
 
@@ -0,0 +1,306 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Stats.h"
+
+#include <set>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+
+namespace ORB_SLAM2
+{
+
+LatencyHistogram::LatencyHistogram()
+{
+    Clear();
+}
+
+void LatencyHistogram::Add(const double us)
+{
+    int bin = 0;
+    if(us>=1.0)
+        bin = std::min(static_cast<int>(std::log2(us)*4)+1,NBINS-1);
+
+    mvBins[bin]++;
+    mnCount++;
+    mSum += us;
+    if(us>mMax)
+        mMax = us;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other)
+{
+    for(int i=0; i<NBINS; i++)
+        mvBins[i] += other.mvBins[i];
+    mnCount += other.mnCount;
+    mSum += other.mSum;
+    if(other.mMax>mMax)
+        mMax = other.mMax;
+}
+
+void LatencyHistogram::Clear()
+{
+    for(int i=0; i<NBINS; i++)
+        mvBins[i] = 0;
+    mnCount = 0;
+    mSum = 0;
+    mMax = 0;
+}
+
+double LatencyHistogram::Percentile(const double p) const
+{
+    if(mnCount==0)
+        return 0;
+
+    const unsigned long nTarget = std::max(static_cast<unsigned long>(std::ceil(p*mnCount)),1ul);
+    unsigned long nAccum = 0;
+    for(int i=0; i<NBINS; i++)
+    {
+        nAccum += mvBins[i];
+        if(nAccum>=nTarget)
+            return std::min(std::pow(2.0,i/4.0),mMax);
+    }
+
+    return mMax;
+}
+
+namespace
+{
+
+// Histograms of one thread. The mutex is only contended when the statistics are read.
+struct ThreadHistograms;
+
+struct Registry
+{
+    std::mutex mMutex;
+    std::set<ThreadHistograms*> mspThreads;
+    // Measurements of threads that have already finished
+    LatencyHistogram mvRetired[Stats::NUM_STAGES];
+};
+
+Registry& GetRegistry()
+{
+    static Registry registry;
+    return registry;
+}
+
+struct ThreadHistograms
+{
+    ThreadHistograms()
+    {
+        Registry &registry = GetRegistry();
+        std::unique_lock<std::mutex> lock(registry.mMutex);
+        registry.mspThreads.insert(this);
+    }
+
+    ~ThreadHistograms()
+    {
+        Registry &registry = GetRegistry();
+        std::unique_lock<std::mutex> lock(registry.mMutex);
+        for(int i=0; i<Stats::NUM_STAGES; i++)
+            registry.mvRetired[i].Merge(mvHist[i]);
+        registry.mspThreads.erase(this);
+    }
+
+    LatencyHistogram mvHist[Stats::NUM_STAGES];
+    std::mutex mMutex;
+};
+
+thread_local ThreadHistograms tHistograms;
+
+}
+
+const char* Stats::StageName(const eStage stage)
+{
+    static const char* names[NUM_STAGES] = {
+        "Tracking", "ORBExtraction", "StereoMatching", "TrackWithMotionModel", "TrackLocalMap",
+        "PoseOptimization", "LocalBundleAdjustment", "KeyFrameCulling", "DetectLoop",
+        "ComputeSim3", "CorrectLoop", "GlobalBundleAdjustment", "KeyFrameHandoff"};
+    return names[stage];
+}
+
+void Stats::Record(const eStage stage, const double us)
+{
+    std::unique_lock<std::mutex> lock(tHistograms.mMutex);
+    tHistograms.mvHist[stage].Add(us);
+}
+
+std::vector<StageStats> Stats::GetSummary()
+{
+    LatencyHistogram vMerged[NUM_STAGES];
+    {
+        Registry &registry = GetRegistry();
+        std::unique_lock<std::mutex> lock(registry.mMutex);
+        for(int i=0; i<NUM_STAGES; i++)
+            vMerged[i].Merge(registry.mvRetired[i]);
+
+        for(std::set<ThreadHistograms*>::iterator sit=registry.mspThreads.begin(); sit!=registry.mspThreads.end(); sit++)
+        {
+            std::unique_lock<std::mutex> lockThread((*sit)->mMutex);
+            for(int i=0; i<NUM_STAGES; i++)
+                vMerged[i].Merge((*sit)->mvHist[i]);
+        }
+    }
+
+    std::vector<StageStats> vStats(NUM_STAGES);
+    for(int i=0; i<NUM_STAGES; i++)
+    {
+        const LatencyHistogram &hist = vMerged[i];
+        StageStats &stats = vStats[i];
+        stats.name = StageName(static_cast<eStage>(i));
+        stats.count = hist.mnCount;
+        stats.mean = hist.mnCount>0 ? hist.mSum/hist.mnCount*1e-3 : 0;
+        stats.median = hist.Percentile(0.5)*1e-3;
+        stats.p90 = hist.Percentile(0.9)*1e-3;
+        stats.p99 = hist.Percentile(0.99)*1e-3;
+        stats.max = hist.mMax*1e-3;
+    }
+
+    return vStats;
+}
+
+void Stats::Reset()
+{
+    Registry &registry = GetRegistry();
+    std::unique_lock<std::mutex> lock(registry.mMutex);
+    for(int i=0; i<NUM_STAGES; i++)
+        registry.mvRetired[i].Clear();
+
+    for(std::set<ThreadHistograms*>::iterator sit=registry.mspThreads.begin(); sit!=registry.mspThreads.end(); sit++)
+    {
+        std::unique_lock<std::mutex> lockThread((*sit)->mMutex);
+        for(int i=0; i<NUM_STAGES; i++)
+            (*sit)->mvHist[i].Clear();
+    }
+}
+
+std::string Stats::ToJSON(const std::vector<StageStats> &vStats)
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(4);
+    ss << "{" << std::endl << "  \"stages\": [" << std::endl;
+    for(size_t i=0; i<vStats.size(); i++)
+    {
+        const StageStats &stats = vStats[i];
+        ss << "    {\"name\": \"" << stats.name << "\", \"count\": " << stats.count
+           << ", \"mean_ms\": " << stats.mean << ", \"median_ms\": " << stats.median
+           << ", \"p90_ms\": " << stats.p90 << ", \"p99_ms\": " << stats.p99
+           << ", \"max_ms\": " << stats.max << "}";
+        if(i+1<vStats.size())
+            ss << ",";
+        ss << std::endl;
+    }
+    ss << "  ]" << std::endl << "}" << std::endl;
+    return ss.str();
+}
+
+std::string Stats::ToCSV(const std::vector<StageStats> &vStats)
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(4);
+    ss << "stage,count,mean_ms,median_ms,p90_ms,p99_ms,max_ms" << std::endl;
+    for(size_t i=0; i<vStats.size(); i++)
+    {
+        const StageStats &stats = vStats[i];
+        ss << stats.name << "," << stats.count << "," << stats.mean << "," << stats.median << ","
+           << stats.p90 << "," << stats.p99 << "," << stats.max << std::endl;
+    }
+    return ss.str();
+}
+
+bool Stats::Save(const std::string &filename)
+{
+    const std::vector<StageStats> vStats = GetSummary();
+    const bool bCSV = filename.size()>=4 && filename.compare(filename.size()-4,4,".csv")==0;
+
+    const std::string strTmp = filename + ".tmp";
+    {
+        std::ofstream f(strTmp.c_str());
+        if(!f.is_open())
+            return false;
+        f << (bCSV ? ToCSV(vStats) : ToJSON(vStats));
+    }
+
+    return std::rename(strTmp.c_str(),filename.c_str())==0;
+}
+
+StatsDumper::StatsDumper(const std::string &filename, const float period):
+    mbFinishRequested(false), mbFinished(false), mFilename(filename), mPeriod(period)
+{
+}
+
+void StatsDumper::Run()
+{
+    const std::chrono::steady_clock::duration period =
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(mPeriod));
+    std::chrono::steady_clock::time_point tNext = std::chrono::steady_clock::now()+period;
+
+    while(1)
+    {
+        // Sleep until the next dump, a finish request wakes up earlier
+        {
+            std::unique_lock<std::mutex> lock(mMutexFinish);
+            while(!mbFinishRequested && mcvFinish.wait_until(lock,tNext)==std::cv_status::no_timeout) {}
+            if(mbFinishRequested)
+                break;
+        }
+
+        Stats::Save(mFilename);
+        tNext += period;
+    }
+
+    // Final statistics
+    Stats::Save(mFilename);
+
+    SetFinish();
+}
+
+void StatsDumper::RequestFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinishRequested = true;
+    mcvFinish.notify_all();
+}
+
+void StatsDumper::SetFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinished = true;
+    mcvFinish.notify_all();
+}
+
+bool StatsDumper::isFinished()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+void StatsDumper::WaitUntilFinished()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    while(!mbFinished)
+        mcvFinish.wait(lock);
+}
+
+} //namespace ORB_SLAM
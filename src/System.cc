@@ -22,16 +22,20 @@
 
 #include "System.h"
 #include "Converter.h"
+#include "Thirdparty/DBoW2/DUtils/Random.h"
 #include <thread>
 #include <pangolin/pangolin.h>
 #include <iomanip>
+#include <cstdlib>
 #include <unistd.h>
 
 namespace ORB_SLAM2
 {
 
 System::System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor,
-               const bool bUseViewer):mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)), mbReset(false),mbActivateLocalizationMode(false),
+               const bool bUseViewer):mSensor(sensor), mbDeterministic(false), mpViewer(static_cast<Viewer*>(NULL)),
+        mpFramePipeline(static_cast<FramePipeline*>(NULL)),
+        mpStatsDumper(static_cast<StatsDumper*>(NULL)), mbReset(false),mbActivateLocalizationMode(false),
         mbDeactivateLocalizationMode(false)
 {
     // Output welcome message
@@ -58,6 +62,17 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
        exit(-1);
     }
 
+    // Deterministic mode: mapping and loop closing run in lockstep with tracking and
+    // RANSAC uses a fixed seed, so that two runs on the same sequence do the same work
+    const int nDeterministic = fsSettings["System.Deterministic"];
+    mbDeterministic = nDeterministic!=0;
+    if(mbDeterministic)
+    {
+        const int nSeed = fsSettings["System.RandomSeed"];
+        DUtils::Random::SeedRandOnce(nSeed);
+        cout << "Deterministic mode enabled, random seed: " << nSeed << endl;
+    }
+
 
     //Load ORB Vocabulary
     cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
@@ -72,12 +87,43 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     }
     cout << "Vocabulary loaded!" << endl << endl;
 
+    // Threads used to convert the descriptors of a frame or keyframe to bag of words
+    int nBowThreads = fsSettings["System.BowThreads"];
+    if(nBowThreads<=0)
+        nBowThreads = min(4,max(1,(int)thread::hardware_concurrency()));
+    mpVocabulary->setTransformThreads(nBowThreads);
+
     //Create KeyFrame Database
     mpKeyFrameDatabase = new KeyFrameDatabase(*mpVocabulary);
 
     //Create the Map
     mpMap = new Map();
 
+    // Bounded memory: matching data of the keyframes beyond the budget is kept in tiles on disk
+    const int nMaxResidentKFs = fsSettings["Map.MaxResidentKeyFrames"];
+    if(nMaxResidentKFs>0)
+    {
+        string strSpillDir = fsSettings["Map.SpillDirectory"];
+        if(strSpillDir.empty())
+        {
+            // No directory given: use a temporary one for this run, removed on shutdown
+            char tmpl[] = "/tmp/orbslam2_spill_XXXXXX";
+            if(!mkdtemp(tmpl))
+            {
+                cerr << "Failed to create a temporary directory for the keyframe spill" << endl;
+                exit(-1);
+            }
+            strSpillDir = tmpl;
+            mStrSpillTempDir = strSpillDir;
+        }
+        const float tileSize = fsSettings["Map.TileSize"];
+        int nTileRadius = fsSettings["Map.TileRadius"];
+        if(nTileRadius<=0)
+            nTileRadius = 1;
+        mpMap->SetKeyFrameBudget(nMaxResidentKFs,strSpillDir,tileSize,nTileRadius);
+        cout << "Keyframe memory budget: " << nMaxResidentKFs << " keyframes, spilled to " << strSpillDir << endl;
+    }
+
     //Create Drawers. These are used by the Viewer
     mpFrameDrawer = new FrameDrawer(mpMap);
     mpMapDrawer = new MapDrawer(mpMap, strSettingsFile);
@@ -86,6 +132,7 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     //(it will live in the main thread of execution, the one that called this constructor)
     mpTracker = new Tracking(this, mpVocabulary, mpFrameDrawer, mpMapDrawer,
                              mpMap, mpKeyFrameDatabase, strSettingsFile, mSensor);
+    mpTracker->SetOfflineMode(mbDeterministic);
 
     //Initialize the Local Mapping thread and launch
     mpLocalMapper = new LocalMapping(mpMap, mSensor==MONOCULAR);
@@ -93,6 +140,7 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
 
     //Initialize the Loop Closing thread and launch
     mpLoopCloser = new LoopClosing(mpMap, mpKeyFrameDatabase, mpVocabulary, mSensor!=MONOCULAR);
+    mpLoopCloser->SetDeterministic(mbDeterministic);
     mptLoopClosing = new thread(&ORB_SLAM2::LoopClosing::Run, mpLoopCloser);
 
     //Initialize the Viewer thread and launch
@@ -112,6 +160,17 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
 
     mpLoopCloser->SetTracker(mpTracker);
     mpLoopCloser->SetLocalMapper(mpLocalMapper);
+
+    //Launch the statistics dump thread
+    const string strStatsFile = fsSettings["Stats.DumpFile"];
+    if(!strStatsFile.empty())
+    {
+        float period = fsSettings["Stats.DumpPeriod"];
+        if(period<=0)
+            period = 10;
+        mpStatsDumper = new StatsDumper(strStatsFile,period);
+        mptStatsDumper = new thread(&ORB_SLAM2::StatsDumper::Run,mpStatsDumper);
+    }
 }
 
 cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp)
@@ -122,39 +181,7 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const
         exit(-1);
     }   
 
-    // Check mode change
-    {
-        unique_lock<mutex> lock(mMutexMode);
-        if(mbActivateLocalizationMode)
-        {
-            mpLocalMapper->RequestStop();
-
-            // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
-
-            mpTracker->InformOnlyTracking(true);
-            mbActivateLocalizationMode = false;
-        }
-        if(mbDeactivateLocalizationMode)
-        {
-            mpTracker->InformOnlyTracking(false);
-            mpLocalMapper->Release();
-            mbDeactivateLocalizationMode = false;
-        }
-    }
-
-    // Check reset
-    {
-    unique_lock<mutex> lock(mMutexReset);
-    if(mbReset)
-    {
-        mpTracker->Reset();
-        mbReset = false;
-    }
-    }
+    CheckModeChangeAndReset();
 
     cv::Mat Tcw = mpTracker->GrabImageStereo(imLeft,imRight,timestamp);
 
@@ -173,50 +200,38 @@ cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const doub
         exit(-1);
     }    
 
-    // Check mode change
-    {
-        unique_lock<mutex> lock(mMutexMode);
-        if(mbActivateLocalizationMode)
-        {
-            mpLocalMapper->RequestStop();
+    CheckModeChangeAndReset();
 
-            // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+    cv::Mat Tcw = mpTracker->GrabImageRGBD(im,depthmap,timestamp);
 
-            mpTracker->InformOnlyTracking(true);
-            mbActivateLocalizationMode = false;
-        }
-        if(mbDeactivateLocalizationMode)
-        {
-            mpTracker->InformOnlyTracking(false);
-            mpLocalMapper->Release();
-            mbDeactivateLocalizationMode = false;
-        }
-    }
+    unique_lock<mutex> lock2(mMutexState);
+    mTrackingState = mpTracker->mState;
+    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
+    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+    return Tcw;
+}
 
-    // Check reset
-    {
-    unique_lock<mutex> lock(mMutexReset);
-    if(mbReset)
+cv::Mat System::TrackMonocularTCC(const cv::Mat &im, const double &timestamp, sem_t *sem_cons_message, sem_t *sem_prod_message, char *result_message)
+{
+    if(mSensor!=MONOCULAR)
     {
-        mpTracker->Reset();
-        mbReset = false;
-    }
+        cerr << "ERROR: you called TrackMonocular but input sensor was not set to Monocular." << endl;
+        exit(-1);
     }
 
-    cv::Mat Tcw = mpTracker->GrabImageRGBD(im,depthmap,timestamp);
+    CheckModeChangeAndReset();
+
+    cv::Mat Tcw = mpTracker->GrabImageMonocularTCC(im,timestamp, sem_cons_message, sem_prod_message, result_message);
 
     unique_lock<mutex> lock2(mMutexState);
     mTrackingState = mpTracker->mState;
     mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
     mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+
     return Tcw;
 }
 
-cv::Mat System::TrackMonocularTCC(const cv::Mat &im, const double &timestamp, sem_t *sem_cons_message, sem_t *sem_prod_message, char *result_message)
+cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
 {
     if(mSensor!=MONOCULAR)
     {
@@ -224,41 +239,98 @@ cv::Mat System::TrackMonocularTCC(const cv::Mat &im, const double &timestamp, se
         exit(-1);
     }
 
-    // Check mode change
+    CheckModeChangeAndReset();
+
+    cv::Mat Tcw = mpTracker->GrabImageMonocular(im,timestamp);
+
+    unique_lock<mutex> lock2(mMutexState);
+    mTrackingState = mpTracker->mState;
+    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
+    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+
+    return Tcw;
+}
+
+std::future<cv::Mat> System::SubmitStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp)
+{
+    if(mSensor!=STEREO)
     {
-        unique_lock<mutex> lock(mMutexMode);
-        if(mbActivateLocalizationMode)
-        {
-            mpLocalMapper->RequestStop();
+        cerr << "ERROR: you called SubmitStereo but input sensor was not set to STEREO." << endl;
+        exit(-1);
+    }
 
-            // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+    // Frames are tracked synchronously in deterministic mode: extraction of the next frame
+    // depends on the tracking state (monocular initialization)
+    if(mbDeterministic)
+    {
+        std::promise<cv::Mat> pose;
+        pose.set_value(TrackStereo(imLeft,imRight,timestamp));
+        return pose.get_future();
+    }
 
-            mpTracker->InformOnlyTracking(true);
-            mbActivateLocalizationMode = false;
-        }
-        if(mbDeactivateLocalizationMode)
-        {
-            mpTracker->InformOnlyTracking(false);
-            mpLocalMapper->Release();
-            mbDeactivateLocalizationMode = false;
-        }
+    return GetFramePipeline()->Submit(imLeft,imRight,timestamp);
+}
+
+std::future<cv::Mat> System::SubmitRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp)
+{
+    if(mSensor!=RGBD)
+    {
+        cerr << "ERROR: you called SubmitRGBD but input sensor was not set to RGBD." << endl;
+        exit(-1);
     }
 
-    // Check reset
+    // Frames are tracked synchronously in deterministic mode: extraction of the next frame
+    // depends on the tracking state (monocular initialization)
+    if(mbDeterministic)
     {
-    unique_lock<mutex> lock(mMutexReset);
-    if(mbReset)
+        std::promise<cv::Mat> pose;
+        pose.set_value(TrackRGBD(im,depthmap,timestamp));
+        return pose.get_future();
+    }
+
+    return GetFramePipeline()->Submit(im,depthmap,timestamp);
+}
+
+std::future<cv::Mat> System::SubmitMonocular(const cv::Mat &im, const double &timestamp)
+{
+    if(mSensor!=MONOCULAR)
     {
-        mpTracker->Reset();
-        mbReset = false;
+        cerr << "ERROR: you called SubmitMonocular but input sensor was not set to Monocular." << endl;
+        exit(-1);
     }
+
+    // Frames are tracked synchronously in deterministic mode: extraction of the next frame
+    // depends on the tracking state (monocular initialization)
+    if(mbDeterministic)
+    {
+        std::promise<cv::Mat> pose;
+        pose.set_value(TrackMonocular(im,timestamp));
+        return pose.get_future();
     }
 
-    cv::Mat Tcw = mpTracker->GrabImageMonocularTCC(im,timestamp, sem_cons_message, sem_prod_message, result_message);
+    return GetFramePipeline()->Submit(im,cv::Mat(),timestamp);
+}
+
+FramePipeline* System::GetFramePipeline()
+{
+    unique_lock<mutex> lock(mMutexPipeline);
+    if(!mpFramePipeline)
+    {
+        mpFramePipeline = new FramePipeline(this,mpTracker,mSensor);
+        mptPipelineExtraction = new thread(&ORB_SLAM2::FramePipeline::RunExtraction,mpFramePipeline);
+        mptPipelineTracking = new thread(&ORB_SLAM2::FramePipeline::RunTracking,mpFramePipeline);
+    }
+
+    return mpFramePipeline;
+}
+
+cv::Mat System::TrackExtractedFrame(Frame &frame, const cv::Mat &imGray)
+{
+    // Frames extracted before the reset still have ids from before it
+    if(CheckModeChangeAndReset())
+        mpFramePipeline->RestartFrameIds(frame);
+
+    cv::Mat Tcw = mpTracker->TrackFrame(frame,imGray);
 
     unique_lock<mutex> lock2(mMutexState);
     mTrackingState = mpTracker->mState;
@@ -268,14 +340,8 @@ cv::Mat System::TrackMonocularTCC(const cv::Mat &im, const double &timestamp, se
     return Tcw;
 }
 
-cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
+bool System::CheckModeChangeAndReset()
 {
-    if(mSensor!=MONOCULAR)
-    {
-        cerr << "ERROR: you called TrackMonocular but input sensor was not set to Monocular." << endl;
-        exit(-1);
-    }
-
     // Check mode change
     {
         unique_lock<mutex> lock(mMutexMode);
@@ -284,10 +350,7 @@ cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
             mpLocalMapper->RequestStop();
 
             // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+            mpLocalMapper->WaitUntilStopped();
 
             mpTracker->InformOnlyTracking(true);
             mbActivateLocalizationMode = false;
@@ -307,17 +370,11 @@ cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
     {
         mpTracker->Reset();
         mbReset = false;
+        return true;
     }
     }
 
-    cv::Mat Tcw = mpTracker->GrabImageMonocular(im,timestamp);
-
-    unique_lock<mutex> lock2(mMutexState);
-    mTrackingState = mpTracker->mState;
-    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
-    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
-
-    return Tcw;
+    return false;
 }
 
 void System::ActivateLocalizationMode()
@@ -332,6 +389,12 @@ void System::DeactivateLocalizationMode()
     mbDeactivateLocalizationMode = true;
 }
 
+void System::SetOfflineMode(const bool flag)
+{
+    // Deterministic mode always runs offline
+    mpTracker->SetOfflineMode(flag || mbDeterministic);
+}
+
 bool System::MapChanged()
 {
     static int n=0;
@@ -353,19 +416,42 @@ void System::Reset()
 
 void System::Shutdown()
 {
+    // Track the frames still in the pipeline before stopping the other threads
+    {
+        unique_lock<mutex> lock(mMutexPipeline);
+        if(mpFramePipeline)
+        {
+            mpFramePipeline->RequestFinish();
+            mptPipelineExtraction->join();
+            mptPipelineTracking->join();
+        }
+    }
+
     mpLocalMapper->RequestFinish();
     mpLoopCloser->RequestFinish();
     if(mpViewer)
     {
         mpViewer->RequestFinish();
-        while(!mpViewer->isFinished())
-            usleep(5000);
+        mpViewer->WaitUntilFinished();
     }
 
     // Wait until all thread have effectively stopped
-    while(!mpLocalMapper->isFinished() || !mpLoopCloser->isFinished() || mpLoopCloser->isRunningGBA())
+    mpLocalMapper->WaitUntilFinished();
+    mpLoopCloser->WaitUntilFinished();
+
+    // Final statistics once all the threads are done
+    if(mpStatsDumper)
     {
-        usleep(5000);
+        mpStatsDumper->RequestFinish();
+        mpStatsDumper->WaitUntilFinished();
+    }
+
+    // Remove the spilled keyframe tiles (and their directory if it was created for this run)
+    mpMap->ReleaseKeyFrameBudget();
+    if(!mStrSpillTempDir.empty())
+    {
+        rmdir(mStrSpillTempDir.c_str());
+        mStrSpillTempDir.clear();
     }
 
     if(mpViewer)
@@ -542,4 +628,9 @@ vector<cv::KeyPoint> System::GetTrackedKeyPointsUn()
     return mTrackedKeyPointsUn;
 }
 
+vector<StageStats> System::GetStats()
+{
+    return Stats::GetSummary();
+}
+
 } //namespace ORB_SLAM
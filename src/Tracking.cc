@@ -33,6 +33,7 @@
 
 #include"Optimizer.h"
 #include"PnPsolver.h"
+#include"Stats.h"
 
 #include<iostream>
 #include <sstream>
@@ -48,7 +49,7 @@ namespace ORB_SLAM2
 {
 
 Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer, MapDrawer *pMapDrawer, Map *pMap, KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor):
-    mState(NO_IMAGES_YET), mSensor(sensor), mbOnlyTracking(false), mbVO(false), mpORBVocabulary(pVoc),
+    mState(NO_IMAGES_YET), mSensor(sensor), mbOnlyTracking(false), mbOffline(false), mbVO(false), mpORBVocabulary(pVoc),
     mpKeyFrameDB(pKFDB), mpInitializer(static_cast<Initializer*>(NULL)), mpSystem(pSys), mpViewer(NULL),
     mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpMap(pMap), mnLastRelocFrameId(0)
 {
@@ -170,129 +171,136 @@ void Tracking::SetViewer(Viewer *pViewer)
 
 cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp)
 {
-    mImGray = imRectLeft;
+    cv::Mat imGray;
+    Frame frame = ExtractStereo(imRectLeft,imRectRight,timestamp,imGray);
+
+    return TrackFrame(frame,imGray);
+}
+
+
+cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp)
+{
+    cv::Mat imGray;
+    Frame frame = ExtractRGBD(imRGB,imD,timestamp,imGray);
+
+    return TrackFrame(frame,imGray);
+}
+
+
+cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp)
+{
+    cv::Mat imGray;
+    Frame frame = ExtractMonocular(im,timestamp,imGray);
+
+    return TrackFrame(frame,imGray);
+}
+
+cv::Mat Tracking::GrabImageMonocularTCC(const cv::Mat &im, const double &timestamp, sem_t *sem_cons_message, sem_t *sem_prod_message, char *result_message)
+{
+    Frame frame = ExtractMonocular(im,timestamp,mImGray);
+    mCurrentFrame.Swap(frame);
+
+    TrackTCC(sem_cons_message, sem_prod_message, result_message);
+
+    return mCurrentFrame.mTcw.clone();
+}
+
+Frame Tracking::ExtractStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp, cv::Mat &imGray)
+{
+    imGray = imRectLeft;
     cv::Mat imGrayRight = imRectRight;
 
-    if(mImGray.channels()==3)
+    if(imGray.channels()==3)
     {
         if(mbRGB)
         {
-            cvtColor(mImGray,mImGray,CV_RGB2GRAY);
+            cvtColor(imGray,imGray,CV_RGB2GRAY);
             cvtColor(imGrayRight,imGrayRight,CV_RGB2GRAY);
         }
         else
         {
-            cvtColor(mImGray,mImGray,CV_BGR2GRAY);
+            cvtColor(imGray,imGray,CV_BGR2GRAY);
             cvtColor(imGrayRight,imGrayRight,CV_BGR2GRAY);
         }
     }
-    else if(mImGray.channels()==4)
+    else if(imGray.channels()==4)
     {
         if(mbRGB)
         {
-            cvtColor(mImGray,mImGray,CV_RGBA2GRAY);
+            cvtColor(imGray,imGray,CV_RGBA2GRAY);
             cvtColor(imGrayRight,imGrayRight,CV_RGBA2GRAY);
         }
         else
         {
-            cvtColor(mImGray,mImGray,CV_BGRA2GRAY);
+            cvtColor(imGray,imGray,CV_BGRA2GRAY);
             cvtColor(imGrayRight,imGrayRight,CV_BGRA2GRAY);
         }
     }
 
-    mCurrentFrame = Frame(mImGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
-
-    Track();
-
-    return mCurrentFrame.mTcw.clone();
+    return Frame(imGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
 }
 
-
-cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp)
+Frame Tracking::ExtractRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp, cv::Mat &imGray)
 {
-    mImGray = imRGB;
+    imGray = imRGB;
     cv::Mat imDepth = imD;
 
-    if(mImGray.channels()==3)
+    if(imGray.channels()==3)
     {
         if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGB2GRAY);
+            cvtColor(imGray,imGray,CV_RGB2GRAY);
         else
-            cvtColor(mImGray,mImGray,CV_BGR2GRAY);
+            cvtColor(imGray,imGray,CV_BGR2GRAY);
     }
-    else if(mImGray.channels()==4)
+    else if(imGray.channels()==4)
     {
         if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGBA2GRAY);
+            cvtColor(imGray,imGray,CV_RGBA2GRAY);
         else
-            cvtColor(mImGray,mImGray,CV_BGRA2GRAY);
+            cvtColor(imGray,imGray,CV_BGRA2GRAY);
     }
 
     if((fabs(mDepthMapFactor-1.0f)>1e-5) || imDepth.type()!=CV_32F)
         imDepth.convertTo(imDepth,CV_32F,mDepthMapFactor);
 
-    mCurrentFrame = Frame(mImGray,imDepth,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
-
-    Track();
-
-    return mCurrentFrame.mTcw.clone();
+    return Frame(imGray,imDepth,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
 }
 
-
-cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp)
+Frame Tracking::ExtractMonocular(const cv::Mat &im, const double &timestamp, cv::Mat &imGray)
 {
-    mImGray = im;
+    imGray = im;
 
-    if(mImGray.channels()==3)
+    if(imGray.channels()==3)
     {
         if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGB2GRAY);
+            cvtColor(imGray,imGray,CV_RGB2GRAY);
         else
-            cvtColor(mImGray,mImGray,CV_BGR2GRAY);
+            cvtColor(imGray,imGray,CV_BGR2GRAY);
     }
-    else if(mImGray.channels()==4)
+    else if(imGray.channels()==4)
     {
         if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGBA2GRAY);
+            cvtColor(imGray,imGray,CV_RGBA2GRAY);
         else
-            cvtColor(mImGray,mImGray,CV_BGRA2GRAY);
+            cvtColor(imGray,imGray,CV_BGRA2GRAY);
     }
 
-    if(mState==NOT_INITIALIZED || mState==NO_IMAGES_YET)
-        mCurrentFrame = Frame(mImGray,timestamp,mpIniORBextractor,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+    // In the pipelined front-end the state may be updated by the tracking of the previous frame
+    // while we extract. At worst the frame right after initialization is extracted with the
+    // initializer extractor (twice the features), which tracking handles fine.
+    const eTrackingState state = mState;
+    if(state==NOT_INITIALIZED || state==NO_IMAGES_YET)
+        return Frame(imGray,timestamp,mpIniORBextractor,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
     else
-        mCurrentFrame = Frame(mImGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
-
-    Track();
-
-    return mCurrentFrame.mTcw.clone();
+        return Frame(imGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
 }
 
-cv::Mat Tracking::GrabImageMonocularTCC(const cv::Mat &im, const double &timestamp, sem_t *sem_cons_message, sem_t *sem_prod_message, char *result_message)
+cv::Mat Tracking::TrackFrame(Frame &frame, const cv::Mat &imGray)
 {
-    mImGray = im;
+    mImGray = imGray;
+    mCurrentFrame.Swap(frame);
 
-    if(mImGray.channels()==3)
-    {
-        if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGB2GRAY);
-        else
-            cvtColor(mImGray,mImGray,CV_BGR2GRAY);
-    }
-    else if(mImGray.channels()==4)
-    {
-        if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGBA2GRAY);
-        else
-            cvtColor(mImGray,mImGray,CV_BGRA2GRAY);
-    }
-
-    if(mState==NOT_INITIALIZED || mState==NO_IMAGES_YET)
-        mCurrentFrame = Frame(mImGray,timestamp,mpIniORBextractor,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
-    else
-        mCurrentFrame = Frame(mImGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
-
-    TrackTCC(sem_cons_message, sem_prod_message, result_message);
+    Track();
 
     return mCurrentFrame.mTcw.clone();
 }
@@ -306,6 +314,13 @@ void Tracking::TrackTCC(sem_t *sem_cons_message, sem_t *sem_prod_message, char *
 
     mLastProcessedState=mState;
 
+    // In offline mode keyframes of previous frames are fully processed before tracking this one.
+    // This must be done before taking the map mutex (Loop Closing needs it to finish a correction)
+    if(mbOffline)
+        WaitForMappingIdle();
+
+    ScopedTimer timer(Stats::TRACKING);
+
     // Get Map Mutex -> Map cannot be changed
     unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
 
@@ -582,6 +597,13 @@ void Tracking::Track()
 
     mLastProcessedState=mState;
 
+    // In offline mode keyframes of previous frames are fully processed before tracking this one.
+    // This must be done before taking the map mutex (Loop Closing needs it to finish a correction)
+    if(mbOffline)
+        WaitForMappingIdle();
+
+    ScopedTimer timer(Stats::TRACKING);
+
     // Get Map Mutex -> Map cannot be changed
     unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
 
@@ -1194,6 +1216,8 @@ void Tracking::UpdateLastFrame()
 
 bool Tracking::TrackWithMotionModel()
 {
+    ScopedTimer timer(Stats::TRACK_MOTION_MODEL);
+
     ORBmatcher matcher(0.9,true);
 
     // Update last frame pose according to its reference keyframe
@@ -1257,6 +1281,8 @@ bool Tracking::TrackWithMotionModel()
 
 bool Tracking::TrackLocalMap()
 {
+    ScopedTimer timer(Stats::TRACK_LOCAL_MAP);
+
     // We have an estimation of the camera pose and some map points tracked in the frame.
     // We retrieve the local map and try to find matches to points in the local map.
 
@@ -1489,9 +1515,9 @@ void Tracking::SearchLocalPoints()
         }
     }
 
-    int nToMatch=0;
-
     // Project points in frame and check its visibility
+    vector<MapPoint*> vpCandidates;
+    vpCandidates.reserve(mvpLocalMapPoints.size());
     for(vector<MapPoint*>::iterator vit=mvpLocalMapPoints.begin(), vend=mvpLocalMapPoints.end(); vit!=vend; vit++)
     {
         MapPoint* pMP = *vit;
@@ -1499,12 +1525,17 @@ void Tracking::SearchLocalPoints()
             continue;
         if(pMP->isBad())
             continue;
-        // Project (this fills MapPoint variables for matching)
-        if(mCurrentFrame.isInFrustum(pMP,0.5))
-        {
-            pMP->IncreaseVisible();
-            nToMatch++;
-        }
+        vpCandidates.push_back(pMP);
+    }
+
+    // Project (this fills MapPoint variables for matching)
+    vector<bool> vbInFrustum;
+    const int nToMatch = mCurrentFrame.isInFrustum(vpCandidates,0.5,vbInFrustum);
+
+    for(size_t i=0; i<vpCandidates.size(); i++)
+    {
+        if(vbInFrustum[i])
+            vpCandidates[i]->IncreaseVisible();
     }
 
     if(nToMatch>0)
@@ -1532,7 +1563,8 @@ void Tracking::UpdateLocalMap()
 
 void Tracking::UpdateLocalPoints()
 {
-    mvpLocalMapPoints.clear();
+    vector<MapPoint*> vpLastLocalMapPoints;
+    vpLastLocalMapPoints.swap(mvpLocalMapPoints);
 
     for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
     {
@@ -1553,6 +1585,14 @@ void Tracking::UpdateLocalPoints()
             }
         }
     }
+
+    // Points that left the local map drop their descriptor distance cache
+    for(vector<MapPoint*>::const_iterator itMP=vpLastLocalMapPoints.begin(), itEndMP=vpLastLocalMapPoints.end(); itMP!=itEndMP; itMP++)
+    {
+        MapPoint* pMP = *itMP;
+        if(pMP->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
+            pMP->ClearDescriptorCache();
+    }
 }
 
 
@@ -1615,11 +1655,12 @@ void Tracking::UpdateLocalKeyFrames()
 
         KeyFrame* pKF = *itKF;
 
-        const vector<KeyFrame*> vNeighs = pKF->GetBestCovisibilityKeyFrames(10);
+        const CovisibilityListPtr pNeighs = pKF->GetCovisibilityList();
+        const size_t nNeighs = min<size_t>(pNeighs->vpKeyFrames.size(),10);
 
-        for(vector<KeyFrame*>::const_iterator itNeighKF=vNeighs.begin(), itEndNeighKF=vNeighs.end(); itNeighKF!=itEndNeighKF; itNeighKF++)
+        for(size_t iNeigh=0; iNeigh<nNeighs; iNeigh++)
         {
-            KeyFrame* pNeighKF = *itNeighKF;
+            KeyFrame* pNeighKF = pNeighs->vpKeyFrames[iNeigh];
             if(!pNeighKF->isBad())
             {
                 if(pNeighKF->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
@@ -1664,6 +1705,9 @@ void Tracking::UpdateLocalKeyFrames()
         mpReferenceKF = pKFmax;
         mCurrentFrame.mpReferenceKF = mpReferenceKF;
     }
+
+    // The local window drives the prefetch of keyframe data when the map memory is bounded
+    mpMap->SetLocalWindow(mvpLocalKeyFrames,mCurrentFrame.GetCameraCenter());
 }
 
 bool Tracking::Relocalization()
@@ -1836,8 +1880,7 @@ void Tracking::Reset()
     if(mpViewer)
     {
         mpViewer->RequestStop();
-        while(!mpViewer->isStopped())
-            usleep(3000);
+        mpViewer->WaitUntilStopped();
     }
 
     // Reset Local Mapping
@@ -1857,6 +1900,8 @@ void Tracking::Reset()
 
     // Clear Map (this erase MapPoints and KeyFrames)
     mpMap->clear();
+    mvpLocalMapPoints.clear();
+    mvpLocalKeyFrames.clear();
 
     KeyFrame::nNextId = 0;
     Frame::nNextId = 0;
@@ -1915,6 +1960,32 @@ void Tracking::InformOnlyTracking(const bool &flag)
     mbOnlyTracking = flag;
 }
 
+void Tracking::SetOfflineMode(const bool &flag)
+{
+    mbOffline = flag;
+}
+
+void Tracking::WaitForMappingIdle()
+{
+    // In localization mode Local Mapping is kept stopped and never becomes idle,
+    // only a loop closure still being processed is waited for
+    if(mbOnlyTracking)
+    {
+        mpLoopClosing->WaitUntilIdle();
+        return;
+    }
+
+    while(!mpLocalMapper->isFinished())
+    {
+        mpLocalMapper->WaitUntilIdle();
+        mpLoopClosing->WaitUntilIdle();
+
+        // A loop closure stops Local Mapping meanwhile, wait until it is released as well
+        if(mpLocalMapper->isIdle() && mpLoopClosing->isIdle())
+            break;
+    }
+}
+
 
 
 } //namespace ORB_SLAM
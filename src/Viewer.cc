@@ -20,7 +20,6 @@
 
 #include "Viewer.h"
 #include <pangolin/pangolin.h>
-#include <unistd.h>
 #include <algorithm>
 #include <semaphore.h>
 #include <fcntl.h>
@@ -247,10 +246,9 @@ void Viewer::Run()
 
         if(Stop())
         {
+            unique_lock<mutex> lock(mMutexWakeUp);
             while(isStopped())
-            {
-                usleep(3000);
-            }
+                mcvWakeUp.wait(lock);
         }
 
         if(CheckFinish())
@@ -274,8 +272,11 @@ bool Viewer::CheckFinish()
 
 void Viewer::SetFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinished = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinished = true;
+    }
+    WakeUp();
 }
 
 bool Viewer::isFinished()
@@ -299,26 +300,48 @@ bool Viewer::isStopped()
 
 bool Viewer::Stop()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    unique_lock<mutex> lock2(mMutexFinish);
-
-    if(mbFinishRequested)
-        return false;
-    else if(mbStopRequested)
     {
+        unique_lock<mutex> lock(mMutexStop);
+        unique_lock<mutex> lock2(mMutexFinish);
+
+        if(mbFinishRequested || !mbStopRequested)
+            return false;
+
         mbStopped = true;
         mbStopRequested = false;
-        return true;
     }
+    WakeUp();
 
-    return false;
-
+    return true;
 }
 
 void Viewer::Release()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    mbStopped = false;
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        mbStopped = false;
+    }
+    WakeUp();
+}
+
+void Viewer::WaitUntilStopped()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    while(!isStopped())
+        mcvWakeUp.wait(lock);
+}
+
+void Viewer::WaitUntilFinished()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    while(!isFinished())
+        mcvWakeUp.wait(lock);
+}
+
+void Viewer::WakeUp()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    mcvWakeUp.notify_all();
 }
 
 }